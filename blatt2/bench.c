@@ -0,0 +1,563 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "halde.h"
+
+/// Number of blocks the synthetic traces keep alive at most.
+#define LIVE_BLOCKS 1000
+
+/// Number of blocks the LIFO trace allocates before freeing them again.
+#define LIFO_BATCH 100
+
+/// One step of a trace: allocate size bytes as block id, or free block id.
+struct op {
+    enum { ALLOC, FREE } kind;
+    uint32_t id;
+    uint32_t size;
+};
+
+struct trace {
+    const char* name;
+    struct op* ops;
+    size_t count;
+    size_t capacity;
+    /// Largest id + 1, i.e. the number of slots needed to replay the trace.
+    uint32_t ids;
+};
+
+struct allocator {
+    const char* name;
+    void* (*alloc)(size_t size);
+    void (*free)(void* ptr);
+    /// Placement policy of halde, see halde_set_placement(). Only used if halde is set.
+    enum halde_placement placement;
+    int halde;
+};
+
+static const struct allocator allocators[] = {
+    {"halde-ff", halde_malloc, halde_free, HALDE_FIRST_FIT, 1},
+    {"halde-nf", halde_malloc, halde_free, HALDE_NEXT_FIT, 1},
+    {"halde-bf", halde_malloc, halde_free, HALDE_BEST_FIT, 1},
+    {"glibc", malloc, free, HALDE_FIRST_FIT, 0},
+};
+
+/// Number of threads that replay the trace at the same time, see -j.
+static unsigned threads = 1;
+
+static void die(const char* message) {
+    perror(message);
+    exit(EXIT_FAILURE);
+}
+
+/// xorshift64, so that a seed gives the same traces everywhere.
+static uint64_t rng_state = 88172645463325252ULL;
+
+static uint32_t random_below(const uint32_t limit) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+
+    return rng_state % limit;
+}
+
+static uint32_t random_between(const uint32_t low, const uint32_t high) {
+    return low + random_below(high - low + 1);
+}
+
+static void push(struct trace* trace, const struct op op) {
+    if (trace->count == trace->capacity) {
+        trace->capacity = trace->capacity ? trace->capacity * 2 : 1024;
+        trace->ops = realloc(trace->ops, trace->capacity * sizeof(struct op));
+        if (!trace->ops) {
+            die("realloc");
+        }
+    }
+
+    trace->ops[trace->count++] = op;
+    if (op.id >= trace->ids) {
+        trace->ids = op.id + 1;
+    }
+}
+
+static void push_alloc(struct trace* trace, const uint32_t id, const uint32_t size) {
+    push(trace, (struct op){ALLOC, id, size});
+}
+
+static void push_free(struct trace* trace, const uint32_t id) {
+    push(trace, (struct op){FREE, id, 0});
+}
+
+/// Sizes of the bimodal trace: mostly small objects, every tenth one a buffer of a few KiB.
+static uint32_t bimodal_size(void) {
+    return random_below(10) ? random_between(16, 64) : random_between(4096, 16384);
+}
+
+static uint32_t small_size(void) {
+    return random_between(16, 256);
+}
+
+/**
+ * @brief Allocate and free in random order, keeping up to LIVE_BLOCKS blocks alive.
+ *
+ * @details Every step picks a random slot: an empty one gets a new block, an occupied one is freed. Lifetimes are
+ * therefore random as well.
+ */
+static void generate_random(struct trace* trace, const size_t count, uint32_t (*size)(void)) {
+    char live[LIVE_BLOCKS] = {0};
+
+    while (trace->count < count) {
+        const uint32_t slot = random_below(LIVE_BLOCKS);
+
+        if (live[slot]) {
+            push_free(trace, slot);
+        } else {
+            push_alloc(trace, slot, size());
+        }
+        live[slot] = !live[slot];
+    }
+}
+
+static void generate_uniform(struct trace* trace, const size_t count) {
+    generate_random(trace, count, small_size);
+}
+
+static void generate_bimodal(struct trace* trace, const size_t count) {
+    generate_random(trace, count, bimodal_size);
+}
+
+/// A block of the lifetime trace and the allocation after which it dies.
+struct death {
+    size_t time;
+    uint32_t id;
+};
+
+/**
+ * @brief Give every block a lifetime of its own: most die young, every tenth one lives for thousands of
+ * allocations.
+ *
+ * @details The blocks still alive are kept in a min-heap ordered by the time they die.
+ */
+static void generate_lifetime(struct trace* trace, const size_t count) {
+    struct death* heap = NULL;
+    size_t alive = 0;
+    size_t capacity = 0;
+
+    for (uint32_t id = 0; trace->count < count; id++) {
+        push_alloc(trace, id, small_size());
+
+        if (alive == capacity) {
+            capacity = capacity ? capacity * 2 : 1024;
+            heap = realloc(heap, capacity * sizeof(struct death));
+            if (!heap) {
+                die("realloc");
+            }
+        }
+
+        // sift the new block up
+        const size_t lifetime = random_below(10) ? random_between(1, 32) : random_between(1000, 20000);
+        size_t i = alive++;
+        for (; i > 0 && heap[(i - 1) / 2].time > id + lifetime; i = (i - 1) / 2) {
+            heap[i] = heap[(i - 1) / 2];
+        }
+        heap[i] = (struct death){id + lifetime, id};
+
+        // free everything that dies now and sift the last block down in its place
+        while (alive > 0 && heap[0].time <= id && trace->count < count) {
+            push_free(trace, heap[0].id);
+
+            const struct death last = heap[--alive];
+            size_t hole = 0;
+            for (size_t child; (child = 2 * hole + 1) < alive; hole = child) {
+                if (child + 1 < alive && heap[child + 1].time < heap[child].time) {
+                    child++;
+                }
+                if (heap[child].time >= last.time) {
+                    break;
+                }
+                heap[hole] = heap[child];
+            }
+            heap[hole] = last;
+        }
+    }
+
+    free(heap);
+}
+
+/// Allocate LIFO_BATCH blocks, then free them newest first, like a stack of temporary objects.
+static void generate_lifo(struct trace* trace, const size_t count) {
+    while (trace->count < count) {
+        for (uint32_t id = 0; id < LIFO_BATCH; id++) {
+            push_alloc(trace, id, small_size());
+        }
+        for (uint32_t id = LIFO_BATCH; id-- > 0;) {
+            push_free(trace, id);
+        }
+    }
+}
+
+/// Keep a queue of LIVE_BLOCKS blocks: every new block replaces the oldest one.
+static void generate_fifo(struct trace* trace, const size_t count) {
+    for (uint32_t id = 0; trace->count < count; id = (id + 1) % LIVE_BLOCKS) {
+        if (trace->count >= LIVE_BLOCKS) {
+            push_free(trace, id);
+        }
+        push_alloc(trace, id, small_size());
+    }
+}
+
+/**
+ * @brief Read a recorded trace.
+ *
+ * @details One operation per line: "a ID SIZE" allocates SIZE bytes as block ID, "f ID" frees block ID again.
+ */
+static void read_trace(struct trace* trace, const char* path) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        die(path);
+    }
+
+    char kind;
+    unsigned long id;
+    unsigned long size;
+    int matched;
+
+    while ((matched = fscanf(file, " %c %lu", &kind, &id)) == 2) {
+        // ids index the slots of the replay, larger ones would alias others
+        if (id >= UINT32_MAX) {
+            break;
+        }
+        if (kind == 'a' && fscanf(file, "%lu", &size) == 1 && size <= UINT32_MAX) {
+            push_alloc(trace, id, size);
+        } else if (kind == 'f') {
+            push_free(trace, id);
+        } else {
+            break;
+        }
+    }
+
+    if (ferror(file)) {
+        die(path);
+    }
+    if (matched != EOF) {
+        fprintf(stderr, "%s: malformed operation %zu\n", path, trace->count + 1);
+        exit(EXIT_FAILURE);
+    }
+
+    fclose(file);
+}
+
+static void write_trace(const struct trace* trace, const char* path) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        die(path);
+    }
+
+    for (size_t i = 0; i < trace->count; i++) {
+        if (trace->ops[i].kind == ALLOC) {
+            fprintf(file, "a %u %u\n", trace->ops[i].id, trace->ops[i].size);
+        } else {
+            fprintf(file, "f %u\n", trace->ops[i].id);
+        }
+    }
+
+    if (fclose(file)) {
+        die(path);
+    }
+}
+
+static uint64_t now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+
+    return (uint64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+static long max_rss(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    return usage.ru_maxrss;
+}
+
+static int compare_latencies(const void* a, const void* b) {
+    const uint64_t x = *(const uint64_t*)a;
+    const uint64_t y = *(const uint64_t*)b;
+
+    return (x > y) - (x < y);
+}
+
+/// One thread replaying the trace with blocks of its own.
+struct worker {
+    pthread_t thread;
+    const struct trace* trace;
+    const struct allocator* allocator;
+    void** blocks;
+    uint64_t* latencies;
+    size_t failed;
+};
+
+static void* replay_ops(void* arg) {
+    struct worker* worker = arg;
+    const struct trace* trace = worker->trace;
+
+    for (size_t i = 0; i < trace->count; i++) {
+        const struct op* op = &trace->ops[i];
+        const uint64_t op_start = now();
+
+        if (op->kind == ALLOC) {
+            char* block = worker->allocator->alloc(op->size);
+            if (block) {
+                // touch the block like a real program would
+                block[0] = 1;
+            } else {
+                worker->failed++;
+            }
+            worker->blocks[op->id] = block;
+        } else {
+            worker->allocator->free(worker->blocks[op->id]);
+            worker->blocks[op->id] = NULL;
+        }
+
+        worker->latencies[i] = now() - op_start;
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Replay the trace against the allocator and print one line of results.
+ *
+ * @details Runs in a process of its own, so that every run starts with a fresh heap and gets its own peak RSS.
+ * The peak RSS is reported as growth during the replay, the trace itself is not counted. For halde, the line also
+ * shows the fragmentation left at the end of the trace and how many free blocks a search examined on average.
+ *
+ * With several threads, every thread replays the whole trace at the same time. The throughput then counts the
+ * operations of all threads, and the latencies are taken over all of them.
+ */
+static void replay(const struct trace* trace, const struct allocator* allocator) {
+    if (allocator->halde) {
+        halde_set_placement(allocator->placement);
+    }
+
+    const size_t total = trace->count * threads;
+    struct worker* workers = calloc(threads, sizeof(struct worker));
+    uint64_t* latencies = malloc(total * sizeof(uint64_t));
+    if (!workers || !latencies) {
+        die("malloc");
+    }
+
+    for (unsigned t = 0; t < threads; t++) {
+        workers[t] = (struct worker){
+            .trace = trace,
+            .allocator = allocator,
+            .blocks = calloc(trace->ids, sizeof(void*)),
+            .latencies = latencies + t * trace->count,
+        };
+        if (!workers[t].blocks) {
+            die("malloc");
+        }
+    }
+
+    // fault in everything but the allocator's memory before taking the baseline
+    memset(latencies, 0, total * sizeof(uint64_t));
+    const long rss_before = max_rss();
+
+    const uint64_t start = now();
+
+    if (threads == 1) {
+        replay_ops(&workers[0]);
+    } else {
+        for (unsigned t = 0; t < threads; t++) {
+            errno = pthread_create(&workers[t].thread, NULL, replay_ops, &workers[t]);
+            if (errno) {
+                die("pthread_create");
+            }
+        }
+        for (unsigned t = 0; t < threads; t++) {
+            pthread_join(workers[t].thread, NULL);
+        }
+    }
+
+    const uint64_t elapsed = now() - start;
+    const long rss_peak = max_rss() - rss_before;
+
+    size_t failed = 0;
+    for (unsigned t = 0; t < threads; t++) {
+        failed += workers[t].failed;
+    }
+
+    qsort(latencies, total, sizeof(uint64_t), compare_latencies);
+
+    printf("%-10s %-8s %3u %9zu %12.0f %7llu %7llu %9ld", trace->name, allocator->name, threads, total,
+           total / (elapsed / 1e9), (unsigned long long)latencies[total / 2],
+           (unsigned long long)latencies[total * 99 / 100], rss_peak);
+    if (allocator->halde) {
+        struct halde_stats stats;
+        halde_stats(&stats);
+
+        printf(" %6.3f %7.1f", stats.fragmentation,
+               stats.searches ? (double)stats.search_steps / stats.searches : 0.0);
+    } else {
+        printf(" %6s %7s", "-", "-");
+    }
+    if (failed) {
+        printf("  (%zu allocations failed)", failed);
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+static void run(const struct trace* trace) {
+    static int header_printed;
+
+    if (trace->count == 0) {
+        return;
+    }
+
+    if (!header_printed) {
+        printf("%-10s %-8s %3s %9s %12s %7s %7s %9s %6s %7s\n", "trace", "alloc", "thr", "ops", "ops/s", "p50 ns", "p99 ns",
+               "RSS KiB", "frag", "steps");
+        header_printed = 1;
+    }
+
+    for (size_t i = 0; i < sizeof(allocators) / sizeof(allocators[0]); i++) {
+        // the child must not print what is still buffered once more
+        fflush(stdout);
+
+        const pid_t pid = fork();
+        if (pid < 0) {
+            die("fork");
+        }
+
+        if (pid == 0) {
+            replay(trace, &allocators[i]);
+            exit(EXIT_SUCCESS);
+        }
+
+        int status;
+        if (waitpid(pid, &status, 0) < 0) {
+            die("waitpid");
+        }
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+            fprintf(stderr, "%s: replay with %s crashed\n", trace->name, allocators[i].name);
+        }
+    }
+}
+
+static const struct {
+    const char* name;
+    void (*generate)(struct trace* trace, size_t count);
+} generators[] = {
+    {"uniform", generate_uniform}, {"bimodal", generate_bimodal}, {"lifo", generate_lifo},
+    {"fifo", generate_fifo},       {"lifetime", generate_lifetime},
+};
+
+static void usage(const char* program) {
+    fprintf(stderr,
+            "Usage: %s [-n OPS] [-s SEED] [-t TRACE] [-f FILE] [-w FILE] [-j THREADS]\n"
+            "  -n OPS   operations per synthetic trace (default 200000)\n"
+            "  -s SEED  seed for the synthetic traces\n"
+            "  -t TRACE only run this trace: uniform, bimodal, lifo, fifo or lifetime\n"
+            "  -f FILE  replay a recorded trace (lines \"a ID SIZE\" and \"f ID\")\n"
+            "  -w FILE  write the selected synthetic trace to FILE instead of running it\n"
+            "  -j THREADS replay every trace in THREADS threads at once (default 1),\n"
+            "           needs halde built with HALDE_THREADS (make bench-threads)\n",
+            program);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char* argv[]) {
+    size_t count = 200000;
+    const char* only = NULL;
+    const char* input = NULL;
+    const char* output = NULL;
+
+    int option;
+    while ((option = getopt(argc, argv, "n:s:t:f:w:j:")) != -1) {
+        switch (option) {
+            case 'n':
+                count = strtoul(optarg, NULL, 10);
+                break;
+            case 's':
+                // xorshift must not start with 0
+                rng_state = strtoull(optarg, NULL, 10) | 1;
+                break;
+            case 't':
+                only = optarg;
+                break;
+            case 'f':
+                input = optarg;
+                break;
+            case 'w':
+                output = optarg;
+                break;
+            case 'j':
+                threads = strtoul(optarg, NULL, 10);
+                if (threads == 0) {
+                    usage(argv[0]);
+                }
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if (optind != argc || (output && !only)) {
+        usage(argv[0]);
+    }
+
+#ifndef HALDE_THREADS
+    if (threads > 1) {
+        fprintf(stderr, "%s: halde is not thread-safe in this build, use bench-threads for -j\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+#endif
+
+    // the traces keep more than the static heap alive
+    halde_set_growable(1);
+
+    if (input) {
+        struct trace trace = {.name = "file"};
+        read_trace(&trace, input);
+
+        run(&trace);
+        free(trace.ops);
+
+        if (!only) {
+            return EXIT_SUCCESS;
+        }
+    }
+
+    int found = 0;
+    for (size_t i = 0; i < sizeof(generators) / sizeof(generators[0]); i++) {
+        if (only && strcmp(only, generators[i].name) != 0) {
+            continue;
+        }
+        found = 1;
+
+        struct trace trace = {.name = generators[i].name};
+        generators[i].generate(&trace, count);
+
+        if (output) {
+            write_trace(&trace, output);
+        } else {
+            run(&trace);
+        }
+        free(trace.ops);
+    }
+
+    if (!found) {
+        fprintf(stderr, "Unknown trace %s\n", only);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
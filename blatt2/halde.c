@@ -1,13 +1,33 @@
+#define _DEFAULT_SOURCE
+
 #include "halde.h"
 
 #include <errno.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef HALDE_THREADS
+#include <pthread.h>
+#endif
 
 /// Magic value for occupied memory chunks.
 #define MAGIC ((void*)0xbaadf00d)
 
+/// Magic value for occupied memory chunks whose physical predecessor is free.
+/// The size of the predecessor is then stored in the footer right in front of the chunk.
+#define MAGIC_PREV_FREE ((void*)0xbaadf11d)
+
+/// Magic value for huge chunks living in a memory mapping of their own.
+#define MAGIC_MAPPED ((void*)0xbaadf22d)
+
+/// Value of the canary behind the heap and behind every arena and huge chunk.
+#define CANARY_VALUE ((int)0xdeadb33f)
+
 /// Size of the heap (in bytes).
 #define SIZE (1024 * 1024 * 1)
 
@@ -27,245 +47,1562 @@ struct canary {
     char mem[SIZE];
     int can;
 };
-struct canary canary = {.mem = {0}, .can = 0xdeadb33f};
+struct canary canary = {.mem = {0}, .can = CANARY_VALUE};
 
 /// Heap-memory area. Due to the conversion sizeof(memory) does not work, sizeof(canary.mem) works.
 char* memory = (char*)canary.mem;
 
-/// Pointer to the first element of the free-memory list.
+/// Granularity of all block sizes, keeps every header aligned like the first one.
+#define ALIGNMENT MBLOCK_SIZE
+
+/// Smallest payload of a block. A free block keeps its back pointer and its footer in there.
+#define MIN_BLOCK_SIZE ALIGNMENT
+
+/// Number of size-class bins, one per ALIGNMENT step.
+#define BIN_COUNT 32
+
+/// Largest payload that is kept in the size-class bins. Bigger blocks go to the large list.
+#define SMALL_LIMIT (BIN_COUNT * ALIGNMENT)
+
+/// Size of every additional arena. Arenas are mapped at a multiple of their size, so the arena of a block can be
+/// found by masking its address.
+#define ARENA_SIZE SIZE
+
+/// Header at the start of every additional arena. The static heap has none.
+struct arena {
+    struct arena* next;
+    struct arena* prev;
+    char* top;
+};
+
+/// Size of the arena header, rounded up so that the first block is aligned.
+#define ARENA_HEADER_SIZE ((sizeof(struct arena) + ALIGNMENT - 1) & ~(ALIGNMENT - 1))
+
+/// Room for the canary at the end of an arena or huge chunk, keeps the alignment.
+#define CANARY_SIZE ALIGNMENT
+
+/// Payload of the single free block a new arena starts with.
+#define ARENA_BLOCK_SIZE (ARENA_SIZE - ARENA_HEADER_SIZE - MBLOCK_SIZE - CANARY_SIZE)
+
+/// With a growable heap, requests above this size get a memory mapping of their own.
+#define HUGE_LIMIT (ARENA_SIZE / 4)
+
+/// Whether the heap may grow beyond the static memory, see halde_set_growable().
+static int growable;
+
+/// What happens to freed memory, see halde_set_scrub().
+static enum halde_scrub scrub = HALDE_SCRUB_HEADER;
+
+/// Set if all free memory has been scrubbed from the start, so that halde_calloc() needs not clear it again.
+static int scrubbed_from_start;
+
+/// Doubly linked list of all additional arenas.
+static struct arena* arenas;
+
+/// No block was ever handed out at or above this address of the static heap. See heap_top().
+static char* static_top;
+
+/// Size-class bins for small free blocks. bins[i] only holds blocks with a size of exactly (i + 1) * ALIGNMENT.
+static struct mblock* bins[BIN_COUNT];
+
+/// Bit i is set if and only if bins[i] is not empty.
+static uint32_t bin_map;
+
+/// Pointer to the first element of the large free list, ordered by address.
 static struct mblock* head;
 
-/**
- * @brief Fully remove an mblock from memory.
- *
- * @details Zero out the memory block as well as any metadata in the mblock.
- */
-void delete_block(struct mblock* block) {
-    char* current = block->memory;
-    while (current < block->memory + block->size) {
-        *current = 0;
-        current++;
+/// How a large block is chosen, see halde_set_placement().
+static enum halde_placement placement = HALDE_FIRST_FIT;
+
+/// Next fit continues its search in the large list here.
+static struct mblock* rover;
+
+/// Root of the large free blocks ordered by size. Best fit keeps the large blocks here instead of in the list.
+static struct mblock* tree;
+
+/// Set once the first call to halde_malloc() turned the memory into one big free block.
+static int initialized;
+
+/// Block counters behind halde_stats(), kept up to date by the list operations.
+static struct {
+    size_t in_use;
+    size_t free;
+    size_t free_blocks;
+    unsigned long long searches;
+    unsigned long long search_steps;
+} usage;
+
+/// Calls to halde_malloc() and halde_free() and the cycles spent in them.
+struct call_stats {
+    unsigned long long malloc_calls;
+    unsigned long long malloc_cycles;
+    unsigned long long free_calls;
+    unsigned long long free_cycles;
+};
+
+static struct call_stats calls;
+
+/// Where and how often halde_stats_every() dumps the statistics.
+static FILE* dump_stream;
+static unsigned long dump_interval;
+static unsigned long long next_dump;
+
+#ifdef HALDE_THREADS
+/// Maximum number of blocks a thread keeps per bin.
+#define CACHE_LIMIT 32
+
+/// Number of blocks a thread fetches from the shared heap at once when its cache for a bin runs empty.
+#define CACHE_REFILL 8
+
+/// Per-thread stacks of small blocks. Cached blocks still count as allocated for the shared heap, so only the
+/// refill and flush paths need the lock.
+struct cache {
+    struct mblock* bins[BIN_COUNT];
+    unsigned count[BIN_COUNT];
+    int registered;
+};
+
+/// Number of calls a thread counts on its own before adding them to the shared statistics.
+#define STATS_BATCH 64
+
+static _Thread_local struct call_stats pending_calls;
+
+/// Protects the bins and the large list.
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static _Thread_local struct cache cache;
+
+/// Only used for its destructor, which hands the cache of an exiting thread back to the shared heap.
+static pthread_key_t cache_key;
+static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+
+#define LOCK() pthread_mutex_lock(&lock)
+#define UNLOCK() pthread_mutex_unlock(&lock)
+#else
+#define LOCK()
+#define UNLOCK()
+#endif
+
+/// Round address up to the next multiple of alignment, which is a power of two.
+static uintptr_t align_up(const uintptr_t address, const size_t alignment) {
+    return (address + alignment - 1) & ~((uintptr_t)alignment - 1);
+}
+
+/// Round size up to the next multiple of ALIGNMENT, but at least MIN_BLOCK_SIZE.
+static size_t align_size(const size_t size) {
+    if (size < MIN_BLOCK_SIZE) {
+        return MIN_BLOCK_SIZE;
     }
 
-    block->next = NULL;
-    block->size = 0;
+    return (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
 }
 
-/// Helper function to visualize the current state of the free-memory list.
-void halde_print(void) {
-    struct mblock* lauf = head;
+static int is_small(const size_t size) {
+    return size <= SMALL_LIMIT;
+}
 
-    // Empty list
-    if (head == NULL) {
-        fprintf(stderr, "(empty)\n");
+static size_t bin_index(const size_t size) {
+    return size / ALIGNMENT - 1;
+}
+
+/// Bytes at the start of a free block's memory used for links: the back pointer of the list, and for large blocks
+/// the children in the size tree.
+#define LINK_SIZE (3 * sizeof(struct mblock*))
+
+/// Part of the block's memory that holds links while the block is free.
+static size_t link_size(const struct mblock* block) {
+    return block->size < LINK_SIZE ? block->size : LINK_SIZE;
+}
+
+/// Free blocks are doubly linked, the back pointer lives in the first bytes of the unused memory.
+static struct mblock* get_prev(const struct mblock* block) {
+    return *(struct mblock* const*)block->memory;
+}
+
+static void set_prev(struct mblock* block, struct mblock* prev) {
+    *(struct mblock**)block->memory = prev;
+}
+
+static struct mblock** tree_left(struct mblock* block) {
+    return (struct mblock**)block->memory + 1;
+}
+
+static struct mblock** tree_right(struct mblock* block) {
+    return (struct mblock**)block->memory + 2;
+}
+
+/// Order of the size tree: by size, equal sizes by address, so that best fit prefers the lowest block.
+static int tree_less(const struct mblock* a, const struct mblock* b) {
+    return a->size < b->size || (a->size == b->size && a < b);
+}
+
+/// The size tree is a treap: a hash of the address serves as random priority and keeps it balanced on average.
+static uint32_t tree_priority(const struct mblock* block) {
+    uint64_t hash = (uintptr_t)block;
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+
+    return hash;
+}
+
+/// Lift the left child of *link into its place.
+static void rotate_right(struct mblock** link) {
+    struct mblock* node = *link;
+    struct mblock* left = *tree_left(node);
+
+    *tree_left(node) = *tree_right(left);
+    *tree_right(left) = node;
+    *link = left;
+}
+
+/// Lift the right child of *link into its place.
+static void rotate_left(struct mblock** link) {
+    struct mblock* node = *link;
+    struct mblock* right = *tree_right(node);
+
+    *tree_right(node) = *tree_left(right);
+    *tree_left(right) = node;
+    *link = right;
+}
+
+static void tree_insert(struct mblock** link, struct mblock* block) {
+    struct mblock* node = *link;
+
+    if (!node) {
+        *tree_left(block) = NULL;
+        *tree_right(block) = NULL;
+        *link = block;
         return;
     }
 
-    // Print each element in the list
-    fprintf(stderr, "HEAD:  ");
-    while (lauf) {
-        fprintf(stderr, "(addr: 0x%08zx, off: %7zu, ", (uintptr_t)lauf, (uintptr_t)lauf - (uintptr_t)memory);
-        fflush(stderr);
-        fprintf(stderr, "size: %7zu)", lauf->size);
-        fflush(stderr);
-
-        if (lauf->next != NULL) {
-            fprintf(stderr, "\n  -->  ");
-            fflush(stderr);
+    // insert as a leaf, then rotate the block up as long as it has the higher priority
+    if (tree_less(block, node)) {
+        tree_insert(tree_left(node), block);
+        if (tree_priority(*tree_left(node)) > tree_priority(node)) {
+            rotate_right(link);
+        }
+    } else {
+        tree_insert(tree_right(node), block);
+        if (tree_priority(*tree_right(node)) > tree_priority(node)) {
+            rotate_left(link);
         }
-        lauf = lauf->next;
     }
-    fprintf(stderr, "\n");
-    fflush(stderr);
 }
 
-void* halde_malloc(const size_t size) {
-    /* no alloc
-     * *head
-     * [size][next][   mem   ]
-     * [1008][NULL][         ]
-     * 1024-(1*16)-(16*0)
-     */
+static void tree_remove(struct mblock* block) {
+    struct mblock** link = &tree;
+    while (*link != block) {
+        link = tree_less(block, *link) ? tree_left(*link) : tree_right(*link);
+    }
 
-    /* one alloc
-     *             *m1        *head
-     * [size][next][   mem   ][size][next][   mem   ]
-     * [ 16 ][FOOD][         ][ 976][NULL][         ]
-     *                        1024-(2*16)-(16*1)
-     */
+    // rotate the block down until it is a leaf, keeping the child with the higher priority on top
+    while (*tree_left(block) || *tree_right(block)) {
+        struct mblock* left = *tree_left(block);
+        struct mblock* right = *tree_right(block);
 
-    /* two alloc
-     *             *m1                    *m2        *head
-     * [size][next][   mem   ][size][next][   mem   ][size][next][   mem   ]
-     * [ 16 ][FOOD][         ][ 16 ][FOOD][         ][ 944][NULL][         ]
-     *                                               1024-(3*16)-(16*2)
-     */
+        if (!right || (left && tree_priority(left) > tree_priority(right))) {
+            rotate_right(link);
+            link = tree_right(left);
+        } else {
+            rotate_left(link);
+            link = tree_left(right);
+        }
+    }
 
-    /* free space
-     *             *m1        *head                              *m2        *1->
-     * [size][next][   mem   ][size][next][   mem   ][size][next][   mem   ][size][next][   mem   ]
-     * [ 16 ][FOOD][         ][ 16 ][*1->][         ][ 16 ][FOOD][         ][ 912][NULL][         ]
-     *                                                                      1024-(4*16)-(16*3)
-     */
+    *link = NULL;
+}
 
-    if (!head) {
-        // use the initial pointer of the memory as the starting block
-        struct mblock* new_head = (struct mblock*)memory;
+/// The list a free block of the given size belongs to.
+static struct mblock** free_list(const size_t size) {
+    return is_small(size) ? &bins[bin_index(size)] : &head;
+}
 
-        // earlier allocations filled the memory
-        if (new_head->next == MAGIC) {
-            return NULL;
-        }
+static int in_static_heap(const void* address) {
+    return (char*)address >= memory && (char*)address < memory + SIZE;
+}
 
-        head = new_head;
+static struct arena* arena_of(const struct mblock* block) {
+    return (struct arena*)((uintptr_t)block & ~((uintptr_t)ARENA_SIZE - 1));
+}
 
-        head->size = SIZE - MBLOCK_SIZE;
-        head->next = NULL;
+/// End of the static heap or the arena the block lives in. The canary sits right there.
+static char* heap_end(const struct mblock* block) {
+    if (in_static_heap(block)) {
+        return memory + SIZE;
     }
 
-    struct mblock* current = head;
-    struct mblock* previous = NULL;
+    return (char*)arena_of(block) + ARENA_SIZE - CANARY_SIZE;
+}
 
-    while (current) {
-        // first fit
-        if (current->size >= size) {
-            break;
+/**
+ * @brief High-water mark of the heap the block lives in.
+ *
+ * @details Memory at or above the mark was never handed out, so it is still zero apart from the links and the
+ * footer of the free block containing it. halde_calloc() uses this to skip the zeroing.
+ */
+static char** heap_top(const struct mblock* block) {
+    if (in_static_heap(block)) {
+        if (!static_top) {
+            static_top = memory;
         }
+        return &static_top;
+    }
 
-        previous = current;
-        current = current->next;
+    return &arena_of(block)->top;
+}
+
+/// Abort if the canary at the given address was overwritten.
+static void check_canary(const char* address) {
+    if (*(const int*)address != CANARY_VALUE) {
+        abort();
     }
+}
 
-    // no memory available
-    if (!current) {
-        errno = ENOMEM;
+/// The block physically following block, or NULL if block is the last one in its heap.
+static struct mblock* next_block(const struct mblock* block) {
+    char* next = (char*)block->memory + block->size;
+
+    return next < heap_end(block) ? (struct mblock*)next : NULL;
+}
+
+/// The tag of an allocated block may be switched by a thread holding the lock while its owner frees it, hence the
+/// atomic accesses to block->next here and in mark_successor().
+static int is_free(const struct mblock* block) {
+    void* const tag = __atomic_load_n(&block->next, __ATOMIC_RELAXED);
+
+    return tag != MAGIC && tag != MAGIC_PREV_FREE && tag != MAGIC_MAPPED;
+}
+
+/// Whether the allocated block is a huge chunk. Its tag may be flipped concurrently, just like in is_free().
+static int is_mapped(const struct mblock* block) {
+    return __atomic_load_n(&block->next, __ATOMIC_RELAXED) == MAGIC_MAPPED;
+}
+
+/// The last word of a free block repeats its size, so that its physical successor can find the block's header.
+static void set_footer(struct mblock* block) {
+    *(size_t*)(block->memory + block->size - sizeof(size_t)) = block->size;
+}
+
+/**
+ * @brief The free block physically preceding the allocated block, or NULL if there is none.
+ *
+ * @details Only works for allocated blocks, as free blocks never have a free predecessor. O(1) by reading the
+ * predecessor's footer.
+ */
+static struct mblock* previous_free_block(struct mblock* block) {
+    if (block->next != MAGIC_PREV_FREE) {
         return NULL;
     }
 
-    // remaining space in block
-    const long int remaining_space = current->size - MBLOCK_SIZE - size;
+    const size_t previous_size = ((size_t*)block)[-1];
+
+    return (struct mblock*)((char*)block - previous_size - MBLOCK_SIZE);
+}
 
-    // does another block fit in the space after? if yes, create one
-    // also prevent implicit casts to unsigned
-    if (remaining_space >= (long long)MBLOCK_SIZE) {
-        struct mblock* new_block = (struct mblock*)(current->memory + size);
-        new_block->size = remaining_space;
-        new_block->next = current->next;
+/// Tell the successor of block, if any, whether block is free.
+static void mark_successor(const struct mblock* block, const int free) {
+    struct mblock* next = next_block(block);
 
-        if (previous) {
-            // there exists a block before the new one
-            // update the pointer accordingly
-            previous->next = new_block;
-        } else {
-            // no block is in front of the new block, so new block becomes the first
-            head = new_block;
-        }
-    } else {
-        // no space to create a block, so either...
-        if (previous) {
-            // ...skip the empty space...
-            previous->next = current->next;
-        } else {
-            // ...or we were at the first block
-            head = current->next;
+    if (next && !is_free(next)) {
+        __atomic_store_n(&next->next, free ? MAGIC_PREV_FREE : MAGIC, __ATOMIC_RELAXED);
+    }
+}
+
+static void list_insert(struct mblock* block);
+
+/// Put a free block into its bin, or into the large list or tree.
+static void insert_block(struct mblock* block) {
+    set_footer(block);
+    mark_successor(block, 1);
+
+    usage.free += block->size;
+    usage.free_blocks++;
+
+    if (is_small(block->size)) {
+        // every block in a bin fits equally well, so simply push to the front
+        const size_t index = bin_index(block->size);
+
+        block->next = bins[index];
+        set_prev(block, NULL);
+        if (bins[index]) {
+            set_prev(bins[index], block);
         }
+
+        bins[index] = block;
+        bin_map |= (uint32_t)1 << index;
+        return;
     }
 
-    // allocate block
-    current->size = size;
-    current->next = MAGIC;
+    if (placement == HALDE_BEST_FIT) {
+        // blocks in the tree are not linked, but the tag must still tell that they are free
+        block->next = NULL;
+        tree_insert(&tree, block);
+        return;
+    }
 
-    return current->memory;
+    list_insert(block);
 }
 
-void halde_free(void* ptr) {
-    if (!ptr) {
-        return;
+/// Insert a large block into the large list, which stays ordered by address, so first fit prefers the lowest block.
+static void list_insert(struct mblock* block) {
+    struct mblock* current = head;
+    struct mblock* previous = NULL;
+
+    while (current && current < block) {
+        previous = current;
+        current = current->next;
     }
 
-    struct mblock* block = ptr;
-    block--;
+    block->next = current;
+    set_prev(block, previous);
 
-    // block is not an allocated block
-    if (block->next != MAGIC) {
-        abort();
+    if (current) {
+        set_prev(current, block);
     }
 
-    if (!head) {
-        // memory was filled, no end block exists
-        block->next = NULL;
+    if (previous) {
+        previous->next = block;
+    } else {
         head = block;
+    }
+}
+
+/// Unlink a free block from its list or the tree. Must happen before block->size changes.
+static void remove_block(struct mblock* block) {
+    usage.free -= block->size;
+    usage.free_blocks--;
+
+    if (!is_small(block->size) && placement == HALDE_BEST_FIT) {
+        tree_remove(block);
         return;
     }
 
-    if (head > block) {
-        // head (beginning of the list) is after the block, making our block the new head
+    if (rover == block) {
+        rover = block->next;
+    }
 
-        if ((char*)block + MBLOCK_SIZE + block->size == (char*)head) {
-            // head is right after the block
-            block->size = block->size + MBLOCK_SIZE + head->size;
-            block->next = head->next;
-        } else {
-            // head is not right after the block
-            block->next = head;
-        }
+    struct mblock** list = free_list(block->size);
+    struct mblock* previous = get_prev(block);
 
-        head = block;
-        return;
+    if (previous) {
+        previous->next = block->next;
+    } else {
+        *list = block->next;
+    }
+
+    if (block->next) {
+        set_prev(block->next, previous);
     }
 
-    // block is after head
-    // this means there's a pointer going from _before_ block to _after_
-    // or
-    // block is after the end of the list
+    if (is_small(block->size) && !*list) {
+        bin_map &= ~((uint32_t)1 << bin_index(block->size));
+    }
+}
 
-    struct mblock* current = head;
-    while (current) {
-        if (current < block && current->next > block) {
-            // 3 options:
-            // 1: current is right before block
-            // 2: current->next is right after block
-            // 3: neither, meaning there are allocated blocks before and after block
+/// Let new_block take the place of old_block in the large list. Keeps the address order if new_block lies between
+/// old_block and its successor.
+static void replace_block(struct mblock* old_block, struct mblock* new_block) {
+    struct mblock* previous = get_prev(old_block);
 
-            // 2 before 1, so that we're pulling free blocks from the back to the front (if possible)
+    if (rover == old_block) {
+        rover = new_block;
+    }
 
-            int has_merged = 0;
+    new_block->next = old_block->next;
+    set_prev(new_block, previous);
 
-            // 2: current->next is right after block
-            if ((char*)block + MBLOCK_SIZE + block->size == (char*)current->next) {
-                struct mblock* next_block = current->next;
-                block->next = next_block->next;
-                block->size = block->size + MBLOCK_SIZE + next_block->size;
+    if (new_block->next) {
+        set_prev(new_block->next, new_block);
+    }
 
-                delete_block(next_block);
-                current->next = block;
+    if (previous) {
+        previous->next = new_block;
+    } else {
+        head = new_block;
+    }
+}
 
-                has_merged = 1;
-            }
+/**
+ * @brief Take a free block out of the free lists, keeping only size bytes of it.
+ *
+ * @details If the rest is large enough for another block, it is split off and handed back to the free lists.
+ */
+static void take_block(struct mblock* block, const size_t size) {
+    if (block->size < size + MBLOCK_SIZE + MIN_BLOCK_SIZE) {
+        // no space to create a block, hand out the whole block
+        remove_block(block);
+        mark_successor(block, 0);
+        return;
+    }
+
+    struct mblock* rest = (struct mblock*)(block->memory + size);
+    rest->size = block->size - size - MBLOCK_SIZE;
+
+    if (!is_small(block->size) && !is_small(rest->size) && placement != HALDE_BEST_FIT) {
+        // the rest stays in the large list at the position of the block
+        replace_block(block, rest);
+        set_footer(rest);
+        usage.free -= size + MBLOCK_SIZE;
+    } else {
+        remove_block(block);
+        insert_block(rest);
+    }
+
+    block->size = size;
+}
+
+/// Smallest non-empty bin that serves size, O(1) thanks to bin_map.
+static struct mblock* find_small(const size_t size) {
+    const uint32_t candidates = bin_map & (UINT32_MAX << bin_index(size));
+
+    if (!candidates) {
+        return NULL;
+    }
 
-            // 1: current is right before block
-            if ((char*)current + MBLOCK_SIZE + current->size == (char*)block) {
-                // expand current to include block
-                current->size = current->size + MBLOCK_SIZE + block->size;
+    return bins[__builtin_ctz(candidates)];
+}
 
-                delete_block(block);
+/**
+ * @brief Large block serving size according to the placement policy, or NULL if there is none.
+ *
+ * @details First fit takes the lowest block in the large list, next fit the first one behind the block found last
+ * time, best fit the smallest one in the size tree. The number of blocks examined goes into the statistics.
+ */
+static struct mblock* find_large(const size_t size) {
+    struct mblock* found = NULL;
+    unsigned long long steps = 0;
 
-                has_merged = 1;
+    if (placement == HALDE_BEST_FIT) {
+        for (struct mblock* node = tree; node; steps++) {
+            if (node->size >= size) {
+                found = node;
+                node = *tree_left(node);
+            } else {
+                node = *tree_right(node);
             }
+        }
+    } else {
+        struct mblock* start = placement == HALDE_NEXT_FIT && rover ? rover : head;
 
-            // no merge possible, block is surrounded by allocated blocks;
-            if (has_merged == 0) {
-                block->next = current->next;
-                current->next = block;
+        // from the start to the end of the list, then wrap around
+        for (struct mblock* current = start; current && !found; current = current->next, steps++) {
+            if (current->size >= size) {
+                found = current;
+            }
+        }
+        for (struct mblock* current = head; current != start && !found; current = current->next, steps++) {
+            if (current->size >= size) {
+                found = current;
             }
+        }
+
+        rover = found;
+    }
+
+    usage.searches++;
+    usage.search_steps += steps;
+
+    return found;
+}
+
+static void print_block(const struct mblock* block) {
+    // offset within the static heap or within the arena
+    const char* base = in_static_heap(block) ? memory : (char*)arena_of(block);
+    fprintf(stderr, "(addr: 0x%08zx, off: %7zu, ", (uintptr_t)block, (uintptr_t)block - (uintptr_t)base);
+    fflush(stderr);
+    fprintf(stderr, "size: %7zu)", block->size);
+    fflush(stderr);
+}
+
+static void print_list(const char* label, const struct mblock* lauf) {
+    fprintf(stderr, "%s", label);
+    while (lauf) {
+        print_block(lauf);
 
-            return;
+        if (lauf->next != NULL) {
+            fprintf(stderr, "\n  -->  ");
+            fflush(stderr);
         }
+        lauf = lauf->next;
+    }
+    fprintf(stderr, "\n");
+    fflush(stderr);
+}
 
-        current = current->next;
+/// Print the size tree in order, smallest block first, just like a list.
+static void print_tree(struct mblock* node, int* first) {
+    if (!node) {
+        return;
+    }
+
+    print_tree(*tree_left(node), first);
+
+    if (!*first) {
+        fprintf(stderr, "\n  -->  ");
     }
+    *first = 0;
+    print_block(node);
+
+    print_tree(*tree_right(node), first);
+}
+
+/// Helper function to visualize the current state of the bins and the large free list or tree.
+void halde_print(void) {
+    LOCK();
+
+    if (head == NULL && tree == NULL && bin_map == 0) {
+        // Empty lists
+        fprintf(stderr, "(empty)\n");
+    }
+
+    // Print each non-empty bin, then the large list
+    for (size_t i = 0; i < BIN_COUNT; i++) {
+        if (bins[i]) {
+            char label[16];
+            snprintf(label, sizeof(label), "%4zu:  ", (i + 1) * ALIGNMENT);
+            print_list(label, bins[i]);
+        }
+    }
+
+    if (head) {
+        print_list("HEAD:  ", head);
+    }
+
+    if (tree) {
+        int first = 1;
+        fprintf(stderr, "TREE:  ");
+        print_tree(tree, &first);
+        fprintf(stderr, "\n");
+    }
+
+    for (const struct arena* arena = arenas; arena; arena = arena->next) {
+        fprintf(stderr, "ARENA: (addr: 0x%08zx, size: %7zu)\n", (uintptr_t)arena, (size_t)ARENA_SIZE);
+    }
+
+    UNLOCK();
+
+#ifdef HALDE_THREADS
+    // blocks held back by the calling thread
+    for (size_t i = 0; i < BIN_COUNT; i++) {
+        if (cache.count[i]) {
+            fprintf(stderr, "%4zu:  %u cached by this thread\n", (i + 1) * ALIGNMENT, cache.count[i]);
+        }
+    }
+#endif
+}
+
+/// Map memory of the given length aligned to that length. Returns NULL if the system has no memory left.
+static char* map_aligned(const size_t length) {
+    char* raw = mmap(NULL, 2 * length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) {
+        return NULL;
+    }
+
+    char* start = (char*)align_up((uintptr_t)raw, length);
+
+    // cut off what is in front and behind of the aligned part
+    if (start > raw) {
+        munmap(raw, start - raw);
+    }
+    if (start + length < raw + 2 * length) {
+        munmap(start + length, raw + 2 * length - (start + length));
+    }
+
+    return start;
+}
+
+/// Map another arena and put its memory into the free lists. Returns 0 if the system has no memory left.
+static int add_arena(void) {
+    struct arena* arena = (struct arena*)map_aligned(ARENA_SIZE);
+    if (!arena) {
+        return 0;
+    }
+
+    arena->prev = NULL;
+    arena->next = arenas;
+    if (arenas) {
+        arenas->prev = arena;
+    }
+    arenas = arena;
+
+    struct mblock* first = (struct mblock*)((char*)arena + ARENA_HEADER_SIZE);
+    first->size = ARENA_BLOCK_SIZE;
+    arena->top = (char*)first;
+    *(int*)heap_end(first) = CANARY_VALUE;
+
+    insert_block(first);
+
+    return 1;
+}
+
+/// Give an arena consisting of one free block only back to the system. The block is not in any list.
+static void remove_arena(struct arena* arena) {
+    if (arena->prev) {
+        arena->prev->next = arena->next;
+    } else {
+        arenas = arena->next;
+    }
+
+    if (arena->next) {
+        arena->next->prev = arena->prev;
+    }
+
+    munmap(arena, ARENA_SIZE);
+}
+
+static uintptr_t page_down(const uintptr_t address) {
+    return address & ~((uintptr_t)sysconf(_SC_PAGESIZE) - 1);
+}
+
+static uintptr_t page_up(const uintptr_t address) {
+    return align_up(address, sysconf(_SC_PAGESIZE));
+}
+
+/**
+ * @brief Serve a huge request from a memory mapping of its own, with the memory aligned as requested.
+ *
+ * @details The header lies in the first page of the mapping, so the mapping can be found again from the header.
+ */
+static struct mblock* map_huge(const size_t size, const size_t alignment) {
+    const size_t length = page_up(alignment + MBLOCK_SIZE + size + CANARY_SIZE);
+
+    char* raw = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) {
+        return NULL;
+    }
+
+    struct mblock* block = (struct mblock*)align_up((uintptr_t)raw + MBLOCK_SIZE, alignment) - 1;
+
+    // give back the pages in front of the header and behind the canary
+    char* start = (char*)page_down((uintptr_t)block);
+    char* end = (char*)page_up((uintptr_t)(block->memory + size + CANARY_SIZE));
+    if (start > raw) {
+        munmap(raw, start - raw);
+    }
+    if (end < raw + length) {
+        munmap(end, raw + length - end);
+    }
+
+    block->size = size;
+    block->next = MAGIC_MAPPED;
+    *(int*)(block->memory + size) = CANARY_VALUE;
+
+    LOCK();
+    usage.in_use += MBLOCK_SIZE + size;
+    UNLOCK();
+
+    return block;
+}
+
+static void unmap_huge(struct mblock* block) {
+    check_canary(block->memory + block->size);
+
+    LOCK();
+    usage.in_use -= MBLOCK_SIZE + block->size;
+    UNLOCK();
+
+    const uintptr_t start = page_down((uintptr_t)block);
+    munmap((void*)start, page_up((uintptr_t)(block->memory + block->size + CANARY_SIZE)) - start);
+}
+
+/**
+ * @brief Take a block of the given (aligned) size from the free lists, or return NULL if there is none.
+ *
+ * @details If fresh is not NULL, it tells whether the block's memory was never handed out before.
+ */
+static struct mblock* allocate(const size_t size, int* fresh) {
+    /* no alloc
+     * *head
+     * [size][next][   mem   ]
+     * [1008][NULL][         ]
+     * 1024-(1*16)-(16*0)
+     */
+
+    /* one alloc
+     *             *m1        *head
+     * [size][next][   mem   ][size][next][   mem   ]
+     * [ 16 ][FOOD][         ][ 976][NULL][         ]
+     *                        1024-(2*16)-(16*1)
+     */
+
+    /* two alloc
+     *             *m1                    *m2        *head
+     * [size][next][   mem   ][size][next][   mem   ][size][next][   mem   ]
+     * [ 16 ][FOOD][         ][ 16 ][FOOD][         ][ 944][NULL][         ]
+     *                                               1024-(3*16)-(16*2)
+     */
+
+    /* free space
+     *             *m1        *head                              *m2        *1->
+     * [size][next][   mem   ][size][next][   mem   ][size][next][   mem   ][size][next][   mem   ]
+     * [ 16 ][FOOD][         ][ 16 ][*1->][         ][ 16 ][FOOD][         ][ 912][NULL][         ]
+     *                                                                      1024-(4*16)-(16*3)
+     */
+
+    if (!initialized) {
+        // use the initial pointer of the memory as the starting block
+        struct mblock* first = (struct mblock*)memory;
+        first->size = SIZE - MBLOCK_SIZE;
+        insert_block(first);
+
+        initialized = 1;
+    }
+
+    // small requests are served from the bins, everything else (or if no bin fits) from the large list
+    struct mblock* current = is_small(size) ? find_small(size) : NULL;
+    if (!current) {
+        current = find_large(size);
+    }
+
+    if (!current && growable && size <= ARENA_BLOCK_SIZE && add_arena()) {
+        // the new arena fits any request of this size
+        current = find_large(size);
+    }
+
+    // no memory available
+    if (!current) {
+        return NULL;
+    }
+
+    take_block(current, size);
+
+    // allocate block
+    current->next = MAGIC;
+    usage.in_use += MBLOCK_SIZE + current->size;
+
+    char** top = heap_top(current);
+    if (fresh) {
+        *fresh = (char*)current >= *top;
+    }
+    if (current->memory + current->size > *top) {
+        *top = current->memory + current->size;
+    }
+
+    return current;
+}
+
+/**
+ * @brief Remove the header of a block that was merged into the block in front of it.
+ *
+ * @details Clears the header and the list links unless scrubbing is off. Above the high-water mark they are
+ * cleared in any case, as halde_calloc() relies on that memory being zero.
+ */
+void delete_block(struct mblock* block) {
+    if (scrub != HALDE_SCRUB_OFF || (char*)block >= *heap_top(block)) {
+        memset(block, 0, MBLOCK_SIZE + link_size(block));
+    }
+}
+
+/// Absorb the free right neighbour of the block.
+static void absorb_next(struct mblock* block, struct mblock* right) {
+    remove_block(right);
+    block->size = block->size + MBLOCK_SIZE + right->size;
+
+    delete_block(right);
+}
+
+/// Whether a free block of this size sits in the address-ordered large list.
+static int in_large_list(const struct mblock* block) {
+    return !is_small(block->size) && placement != HALDE_BEST_FIT;
+}
+
+/**
+ * @brief Hand an allocated block back to the free lists, merging it with its free neighbours.
+ *
+ * @details The neighbours are found in O(1) through the boundary tags. Merging does not change the address order of
+ * the large list, so if a neighbour is in there, the merged block simply takes its place, which keeps the whole free
+ * O(1). Only a block without such a neighbour is inserted by walking the list, or into the bins or the size tree.
+ */
+static void release(struct mblock* block) {
+    usage.in_use -= MBLOCK_SIZE + block->size;
+
+    if (!next_block(block)) {
+        // the block may have overflowed into the canary
+        check_canary(heap_end(block));
+    }
+
+    if (scrub == HALDE_SCRUB_FULL) {
+        memset(block->memory, 0, block->size);
+    }
+
+    struct mblock* right = next_block(block);
+    if (right && !is_free(right)) {
+        right = NULL;
+    }
+    struct mblock* left = previous_free_block(block);
+
+    // the neighbour in the large list whose place the merged block takes over
+    struct mblock* anchor = NULL;
+    if (left && in_large_list(left)) {
+        anchor = left;
+    } else if (right && in_large_list(right)) {
+        anchor = right;
+    }
+
+    struct mblock* merged = left ? left : block;
+    size_t size = block->size;
+    if (left) {
+        size += left->size + MBLOCK_SIZE;
+    }
+    if (right) {
+        size += MBLOCK_SIZE + right->size;
+    }
+
+    if (left && left != anchor) {
+        remove_block(left);
+    }
+    if (right && right != anchor) {
+        remove_block(right);
+    }
+    if (anchor) {
+        usage.free += size - anchor->size;
+        if (anchor == right) {
+            replace_block(right, merged);
+        }
+    }
+
+    // the headers in the middle go away before the sizes change, they tell how much to clear
+    if (right) {
+        delete_block(right);
+    }
+    if (left) {
+        delete_block(block);
+        if (scrub == HALDE_SCRUB_FULL) {
+            // the old footer of left is now in the middle of the block
+            ((size_t*)block)[-1] = 0;
+        }
+    }
+    merged->size = size;
+
+    if (!in_static_heap(merged) && merged->size == ARENA_BLOCK_SIZE) {
+        // the whole arena is free again
+        if (anchor) {
+            remove_block(merged);
+        }
+        remove_arena(arena_of(merged));
+        return;
+    }
+
+    if (anchor) {
+        set_footer(merged);
+        mark_successor(merged, 1);
+        return;
+    }
+
+    insert_block(merged);
+}
+
+/// Split everything beyond size off an allocated block and free it.
+static void shrink_block(struct mblock* block, const size_t size) {
+    if (block->size < size + MBLOCK_SIZE + MIN_BLOCK_SIZE) {
+        // the rest is too small to be a block of its own
+        return;
+    }
+
+    struct mblock* rest = (struct mblock*)(block->memory + size);
+    rest->size = block->size - size - MBLOCK_SIZE;
+    rest->next = MAGIC;
+    block->size = size;
+
+    release(rest);
+}
+
+/// Try to resize an allocated block without moving it. Returns 0 if the right neighbour is not free or too small.
+static int resize_block(struct mblock* block, const size_t size) {
+    if (size > block->size) {
+        struct mblock* right = next_block(block);
+        if (!right || !is_free(right) || block->size + MBLOCK_SIZE + right->size < size) {
+            return 0;
+        }
+
+        usage.in_use += MBLOCK_SIZE + right->size;
+        absorb_next(block, right);
+        mark_successor(block, 0);
+
+        // the block now reaches into memory that may never have been handed out
+        char** top = heap_top(block);
+        if (block->memory + block->size > *top) {
+            *top = block->memory + block->size;
+        }
+    }
+
+    shrink_block(block, size);
+
+    return 1;
+}
+
+/**
+ * @brief Take a block whose memory is aligned to alignment from the free lists, or return NULL if there is none.
+ *
+ * @details Allocates enough to move the memory up to the next aligned address. What is skipped in front becomes a
+ * free block of its own, what is left behind is split off like on a shrinking realloc.
+ */
+static struct mblock* allocate_aligned(const size_t size, const size_t alignment) {
+    struct mblock* block = allocate(size + alignment + MBLOCK_SIZE + MIN_BLOCK_SIZE, NULL);
+    if (!block) {
+        return NULL;
+    }
+
+    if ((uintptr_t)block->memory % alignment != 0) {
+        struct mblock* aligned =
+            (struct mblock*)align_up((uintptr_t)block->memory + MBLOCK_SIZE + MIN_BLOCK_SIZE, alignment) - 1;
+
+        aligned->size = block->memory + block->size - aligned->memory;
+        aligned->next = MAGIC;
+        block->size = (char*)aligned - block->memory;
+
+        release(block);
+        block = aligned;
+    }
+
+    shrink_block(block, size);
+
+    return block;
+}
+
+/// Cheap timestamp for the call statistics: the time stamp counter where available, nanoseconds otherwise.
+static uint64_t timestamp(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}
+
+/// Fill in the statistics. The caller holds the lock.
+static void collect_stats(struct halde_stats* stats) {
+    stats->bytes_in_use = usage.in_use;
+    stats->bytes_free = usage.free;
+    stats->free_blocks = usage.free_blocks;
+
+    // the largest block is either in the large list or in the highest non-empty bin
+    stats->largest_free_block = bin_map ? (size_t)(32 - __builtin_clz(bin_map)) * ALIGNMENT : 0;
+    for (const struct mblock* current = head; current; current = current->next) {
+        if (current->size > stats->largest_free_block) {
+            stats->largest_free_block = current->size;
+        }
+    }
+    for (struct mblock* node = tree; node; node = *tree_right(node)) {
+        if (node->size > stats->largest_free_block) {
+            stats->largest_free_block = node->size;
+        }
+    }
+
+    stats->fragmentation = usage.free ? 1.0 - (double)stats->largest_free_block / usage.free : 0.0;
+    stats->searches = usage.searches;
+    stats->search_steps = usage.search_steps;
+
+    stats->malloc_calls = calls.malloc_calls;
+    stats->malloc_cycles = calls.malloc_cycles;
+    stats->free_calls = calls.free_calls;
+    stats->free_cycles = calls.free_cycles;
+}
+
+static void write_stats(FILE* stream, const struct halde_stats* stats) {
+    fprintf(stream,
+            "{\"bytes_in_use\": %zu, \"bytes_free\": %zu, \"largest_free_block\": %zu, \"free_blocks\": %zu, "
+            "\"fragmentation\": %.4f, \"malloc_calls\": %llu, \"malloc_cycles\": %llu, \"free_calls\": %llu, "
+            "\"free_cycles\": %llu, \"searches\": %llu, \"search_steps\": %llu}\n",
+            stats->bytes_in_use, stats->bytes_free, stats->largest_free_block, stats->free_blocks,
+            stats->fragmentation, stats->malloc_calls, stats->malloc_cycles, stats->free_calls, stats->free_cycles,
+            stats->searches, stats->search_steps);
+    fflush(stream);
+}
+
+/// Add calls counted elsewhere to the statistics and dump them if it is time to. The caller holds the lock.
+static void add_calls(const struct call_stats* counted) {
+    calls.malloc_calls += counted->malloc_calls;
+    calls.malloc_cycles += counted->malloc_cycles;
+    calls.free_calls += counted->free_calls;
+    calls.free_cycles += counted->free_cycles;
+
+    if (dump_stream && calls.malloc_calls >= next_dump) {
+        struct halde_stats stats;
+        collect_stats(&stats);
+        write_stats(dump_stream, &stats);
+
+        next_dump = calls.malloc_calls + dump_interval;
+    }
+}
+
+/// Count a call to halde_malloc() (is_malloc != 0) or halde_free() that started at the given timestamp.
+static void count_call(const int is_malloc, const uint64_t start) {
+    const uint64_t cycles = timestamp() - start;
+
+#ifdef HALDE_THREADS
+    // threads count on their own and only take the lock every STATS_BATCH calls
+    struct call_stats* counted = &pending_calls;
+#else
+    struct call_stats single = {0};
+    struct call_stats* counted = &single;
+#endif
+
+    if (is_malloc) {
+        counted->malloc_calls++;
+        counted->malloc_cycles += cycles;
+    } else {
+        counted->free_calls++;
+        counted->free_cycles += cycles;
+    }
+
+#ifdef HALDE_THREADS
+    if (counted->malloc_calls + counted->free_calls < STATS_BATCH) {
+        return;
+    }
+#endif
+
+    LOCK();
+    add_calls(counted);
+    UNLOCK();
+
+    *counted = (struct call_stats){0};
+}
+
+#ifdef HALDE_THREADS
+/// Cached blocks are chained through their first word, the second one marks them as cached by this thread.
+static struct mblock** cache_link(struct mblock* block) {
+    return (struct mblock**)block->memory;
+}
+
+static struct cache** cache_owner(struct mblock* block) {
+    return (struct cache**)block->memory + 1;
+}
+
+static void cache_key_create(void);
+
+static void cache_push(struct mblock* block, const size_t index) {
+    if (!cache.registered) {
+        // any non-NULL value makes pthreads run the destructor on thread exit
+        pthread_once(&cache_key_once, cache_key_create);
+        pthread_setspecific(cache_key, &cache);
+        cache.registered = 1;
+    }
+
+    *cache_link(block) = cache.bins[index];
+    *cache_owner(block) = &cache;
+    cache.bins[index] = block;
+    cache.count[index]++;
+}
+
+static struct mblock* cache_pop(const size_t index) {
+    struct mblock* block = cache.bins[index];
+
+    if (block) {
+        cache.bins[index] = *cache_link(block);
+        cache.count[index]--;
+        *cache_owner(block) = NULL;
+    }
+
+    return block;
+}
+
+/// Give up to count blocks of a bin back to the shared heap. The caller holds the lock.
+static void cache_flush(const size_t index, unsigned count) {
+    struct mblock* block;
+
+    while (count-- > 0 && (block = cache_pop(index))) {
+        release(block);
+    }
+}
+
+static void cache_flush_all(void) {
+    LOCK();
+    for (size_t i = 0; i < BIN_COUNT; i++) {
+        cache_flush(i, cache.count[i]);
+    }
+    UNLOCK();
+}
+
+static void cache_destructor(void* unused) {
+    (void)unused;
+    cache_flush_all();
+
+    LOCK();
+    add_calls(&pending_calls);
+    UNLOCK();
+}
+
+static void cache_key_create(void) {
+    pthread_key_create(&cache_key, cache_destructor);
+}
+
+/// Refill the cache of a bin from the shared heap and return one of the blocks, or NULL if memory is exhausted.
+static struct mblock* cache_refill(const size_t index) {
+    const size_t size = (index + 1) * ALIGNMENT;
+
+    LOCK();
+    struct mblock* block = allocate(size, NULL);
+    for (unsigned i = 1; block && i < CACHE_REFILL; i++) {
+        struct mblock* extra = allocate(size, NULL);
+        if (!extra) {
+            break;
+        }
+        cache_push(extra, index);
+    }
+    UNLOCK();
+
+    return block;
+}
+
+static struct mblock* cache_alloc(const size_t index) {
+    struct mblock* block = cache_pop(index);
+    if (!block) {
+        block = cache_refill(index);
+    }
+
+    if (!block) {
+        // memory might only be exhausted because of our own cache
+        cache_flush_all();
+        block = cache_refill(index);
+    }
+
+    return block;
+}
+
+/// Whether block is currently sitting in this thread's cache, i.e. is freed a second time.
+static int is_cached(struct mblock* block, const size_t index) {
+    if (*cache_owner(block) != &cache) {
+        return 0;
+    }
+
+    for (struct mblock* current = cache.bins[index]; current; current = *cache_link(current)) {
+        if (current == block) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+#endif
+
+/**
+ * @brief Clear the first size bytes of a newly allocated block.
+ *
+ * @details Memory that is known to be clean (fresh) is zero except for the links and the footer the block had
+ * while it was free, so only these are cleared.
+ */
+static void zero_memory(struct mblock* block, const size_t size, const int clean) {
+    if (clean) {
+        memset(block->memory, 0, link_size(block));
+        memset(block->memory + block->size - sizeof(size_t), 0, sizeof(size_t));
+    } else {
+        memset(block->memory, 0, size);
+    }
+}
+
+/// Larger than the whole heap, also keeps align_size() from overflowing.
+static int is_too_large(const size_t size) {
+    return size > (growable ? SIZE_MAX / 2 : SIZE - MBLOCK_SIZE);
+}
+
+/// Like is_too_large(), including the room to move the memory up to alignment. Each bound is checked before the
+/// sum is formed, so that a huge alignment cannot wrap it around.
+static int is_too_large_aligned(const size_t size, const size_t alignment) {
+    const size_t overhead = MBLOCK_SIZE + MIN_BLOCK_SIZE;
+
+    return is_too_large(size) || alignment > SIZE_MAX / 2 - overhead || size > SIZE_MAX / 2 - overhead - alignment ||
+           is_too_large(size + alignment + overhead);
+}
+
+static void* malloc_memory(const size_t size) {
+    if (is_too_large(size)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    const size_t block_size = align_size(size);
+    struct mblock* block;
+    int fresh = 0;
+
+    if (growable && block_size > HUGE_LIMIT) {
+        // new mappings are always zeroed
+        block = map_huge(block_size, ALIGNMENT);
+        fresh = 1;
+#ifdef HALDE_THREADS
+    } else if (is_small(block_size)) {
+        block = cache_alloc(bin_index(block_size));
+#endif
+    } else {
+        LOCK();
+        block = allocate(block_size, &fresh);
+        UNLOCK();
+    }
+
+    if (!block) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if (scrub == HALDE_SCRUB_ON_ALLOCATE) {
+        zero_memory(block, size, fresh);
+    }
+
+    return block->memory;
+}
+
+static void free_memory(void* ptr) {
+    struct mblock* block = ptr;
+    block--;
+
+    // block is not an allocated block
+    if (is_free(block)) {
+        abort();
+    }
+
+    if (is_mapped(block)) {
+        unmap_huge(block);
+        return;
+    }
+
+#ifdef HALDE_THREADS
+    if (is_small(block->size)) {
+        const size_t index = bin_index(block->size);
+
+        if (is_cached(block, index)) {
+            abort();
+        }
+
+        if (cache.count[index] >= CACHE_LIMIT) {
+            // make room for the block by handing half of the cache back
+            LOCK();
+            cache_flush(index, CACHE_LIMIT / 2);
+            UNLOCK();
+        }
+
+        if (scrub == HALDE_SCRUB_FULL) {
+            memset(block->memory, 0, block->size);
+        }
+
+        cache_push(block, index);
+        return;
+    }
+#endif
+
+    LOCK();
+    release(block);
+    UNLOCK();
+}
+
+void* halde_malloc(const size_t size) {
+    const uint64_t start = timestamp();
+
+    void* ptr = malloc_memory(size);
+
+    count_call(1, start);
+
+    return ptr;
+}
+
+void halde_free(void* ptr) {
+    if (!ptr) {
+        return;
+    }
+
+    const uint64_t start = timestamp();
+
+    free_memory(ptr);
+
+    count_call(0, start);
+}
+
+void halde_set_growable(const int enable) {
+    LOCK();
+    growable = enable;
+    UNLOCK();
+}
+
+/// Move all blocks of the size tree into the large list.
+static void tree_to_list(struct mblock* node) {
+    if (!node) {
+        return;
+    }
+
+    // the list links do not overlap the tree links
+    tree_to_list(*tree_left(node));
+    tree_to_list(*tree_right(node));
+    list_insert(node);
+}
+
+void halde_set_placement(const enum halde_placement policy) {
+    LOCK();
+    if (policy == HALDE_BEST_FIT && placement != HALDE_BEST_FIT) {
+        for (struct mblock* current = head; current;) {
+            struct mblock* next = current->next;
+
+            // blocks in the tree are not linked, just like in insert_block()
+            current->next = NULL;
+            tree_insert(&tree, current);
+            current = next;
+        }
+        head = NULL;
+    } else if (policy != HALDE_BEST_FIT && placement == HALDE_BEST_FIT) {
+        tree_to_list(tree);
+        tree = NULL;
+    }
+
+    placement = policy;
+    rover = NULL;
+    UNLOCK();
+}
+
+void halde_set_scrub(const enum halde_scrub policy) {
+    LOCK();
+    // free memory is only known to be clean if every block was scrubbed when it was freed
+    scrubbed_from_start = policy == HALDE_SCRUB_FULL && (scrubbed_from_start || !initialized);
+    scrub = policy;
+    UNLOCK();
+}
+
+void* halde_realloc(void* ptr, const size_t size) {
+    if (!ptr) {
+        return halde_malloc(size);
+    }
+
+    if (size == 0) {
+        halde_free(ptr);
+        return NULL;
+    }
+
+    struct mblock* block = ptr;
+    block--;
+
+    // block is not an allocated block
+    if (is_free(block)) {
+        abort();
+    }
+
+    if (is_too_large(size)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    const size_t block_size = align_size(size);
+
+    if (!is_mapped(block)) {
+        LOCK();
+        const int resized = resize_block(block, block_size);
+        UNLOCK();
+
+        if (resized) {
+            return ptr;
+        }
+    } else if (block_size <= block->size) {
+        // huge blocks keep their mapping when shrinking
+        return ptr;
+    }
+
+    // no room next to the block, move it
+    void* moved = halde_malloc(size);
+    if (!moved) {
+        return NULL;
+    }
+
+    memcpy(moved, ptr, block->size < size ? block->size : size);
+    halde_free(ptr);
+
+    return moved;
+}
+
+void* halde_calloc(const size_t nmemb, const size_t size) {
+    if ((size && nmemb > SIZE_MAX / size) || is_too_large(nmemb * size)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    const size_t block_size = align_size(nmemb * size);
+    struct mblock* block;
+    int fresh = 0;
+
+    if (growable && block_size > HUGE_LIMIT) {
+        // new mappings are always zeroed
+        block = map_huge(block_size, ALIGNMENT);
+        fresh = 1;
+    } else {
+        LOCK();
+        block = allocate(block_size, &fresh);
+        UNLOCK();
+    }
+
+    if (!block) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    zero_memory(block, nmemb * size, fresh || scrubbed_from_start);
+
+    return block->memory;
+}
+
+void* halde_aligned_alloc(const size_t alignment, const size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if (alignment <= ALIGNMENT) {
+        // every block is aligned like this anyway
+        return halde_malloc(size);
+    }
+
+    if (is_too_large_aligned(size, alignment)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    const size_t block_size = align_size(size);
+    struct mblock* block;
+    int fresh = 0;
+
+    if (growable && block_size > HUGE_LIMIT) {
+        block = map_huge(block_size, alignment);
+        fresh = 1;
+    } else {
+        LOCK();
+        block = allocate_aligned(block_size, alignment);
+        UNLOCK();
+    }
+
+    if (!block) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if (scrub == HALDE_SCRUB_ON_ALLOCATE) {
+        zero_memory(block, size, fresh);
+    }
+
+    return block->memory;
+}
+
+void halde_stats(struct halde_stats* stats) {
+    LOCK();
+    collect_stats(stats);
+    UNLOCK();
+
+#ifdef HALDE_THREADS
+    // calls of the calling thread that are not added yet
+    stats->malloc_calls += pending_calls.malloc_calls;
+    stats->malloc_cycles += pending_calls.malloc_cycles;
+    stats->free_calls += pending_calls.free_calls;
+    stats->free_cycles += pending_calls.free_cycles;
+#endif
+}
+
+void halde_stats_json(FILE* stream) {
+    struct halde_stats stats;
+    halde_stats(&stats);
+
+    write_stats(stream, &stats);
+}
 
-    // if we reached this point, then block is after head, but head has no next
-    block->next = NULL;
-    head->next = block;
+void halde_stats_every(FILE* stream, const unsigned long interval) {
+    LOCK();
+    dump_stream = interval ? stream : NULL;
+    dump_interval = interval;
+    next_dump = calls.malloc_calls + interval;
+    UNLOCK();
 }
@@ -1,7 +1,16 @@
 #pragma once
 
+#include <stdio.h>
 #include <sys/types.h>
 
+/*
+   Compiling halde.c with -DHALDE_THREADS (and -pthread) makes all
+   functions thread-safe. Every thread then keeps a small cache of
+   recently freed small blocks, which it serves allocations of the
+   same size from without taking the heap lock. The cache of a thread
+   is handed back to the heap when the thread exits.
+*/
+
 /*
    halde_malloc() allocates size bytes and returns a pointer to the
    allocated memory. The memory is not cleared.
@@ -22,11 +31,161 @@ void* halde_malloc(size_t size);
 */
 void halde_free(void* ptr);
 
+/*
+   halde_realloc() changes the size of the memory block pointed to by ptr
+   to size bytes. The contents are unchanged up to the minimum of the old
+   and the new size. The block grows in place if the memory right behind
+   it is free, and shrinks in place by handing the rest back to the heap.
+   Otherwise it is moved to a new block and the old one is freed.
+
+   If ptr is NULL, the call is equivalent to halde_malloc(size). If size
+   is 0, the call is equivalent to halde_free(ptr) and NULL is returned.
+
+   RETURN VALUE: The value returned is a pointer to the (possibly moved)
+   memory or NULL if the request fails. In that case, the original block
+   is left untouched and errno is set to indicate the error.
+*/
+void* halde_realloc(void* ptr, size_t size);
+
+/*
+   halde_calloc() allocates memory for an array of nmemb elements of size
+   bytes each. The memory is set to zero; memory that was never handed
+   out before is known to be zero already and only partially cleared.
+
+   RETURN VALUE: The value returned is a pointer to the allocated memory
+   or NULL if the request fails, including nmemb * size overflowing. The
+   errno will be set to indicate the error.
+*/
+void* halde_calloc(size_t nmemb, size_t size);
+
+/*
+   halde_aligned_alloc() allocates size bytes whose address is a multiple
+   of alignment, which must be a power of two. The memory is not cleared
+   and is freed with halde_free(). Memory skipped in front of the aligned
+   address is handed back to the heap.
+
+   RETURN VALUE: The value returned is a pointer to the allocated memory
+   or NULL if the request fails. The errno will be set to EINVAL if
+   alignment is not a power of two and to ENOMEM if there is not enough
+   memory.
+*/
+void* halde_aligned_alloc(size_t alignment, size_t size);
+
 /*
  * halde_print() is a non-standard function which prints the internal
- * state of the free list.
+ * state of the free lists: every non-empty size-class bin followed by
+ * the list of large blocks.
  *
  * This function can be used to debug the implementation and compare the
  * behavior with other implementations.
  */
 void halde_print(void);
+
+/*
+ * halde_set_growable() is a non-standard function which allows (enable != 0)
+ * or forbids (enable == 0) the heap to grow beyond its static memory.
+ *
+ * A growable heap maps another arena of 1 MiB whenever the existing ones are
+ * full, and gives arenas back to the system as soon as they are completely
+ * free again. Requests larger than a quarter arena get a memory mapping of
+ * their own. By default the heap is not growable.
+ */
+void halde_set_growable(int enable);
+
+/**
+ * How halde chooses among the large free blocks, see halde_set_placement().
+ */
+enum halde_placement {
+    /** The free block with the lowest address that is large enough. */
+    HALDE_FIRST_FIT,
+    /** Like first fit, but each search continues where the last one stopped. */
+    HALDE_NEXT_FIT,
+    /** The smallest free block that is large enough, the lowest one among equally small ones. */
+    HALDE_BEST_FIT,
+};
+
+/*
+ * halde_set_placement() is a non-standard function which selects how a
+ * block is chosen for requests larger than 512 bytes, and for smaller ones
+ * if no free block of a fitting size class is left. The default is
+ * HALDE_FIRST_FIT.
+ *
+ * First and next fit search the large blocks ordered by address. Best fit
+ * keeps them in a tree ordered by size, which makes searching, freeing and
+ * splitting take logarithmic time. The policy is best selected before the
+ * first allocation, switching later on reorganises all free large blocks.
+ */
+void halde_set_placement(enum halde_placement policy);
+
+/**
+ * What halde does with memory that is freed, see halde_set_scrub().
+ */
+enum halde_scrub {
+    /** Freed memory is left as it is. */
+    HALDE_SCRUB_OFF,
+    /** The headers of merged blocks are cleared, so that freeing them again is detected. */
+    HALDE_SCRUB_HEADER,
+    /** Freed memory is cleared completely. */
+    HALDE_SCRUB_FULL,
+    /** Like HALDE_SCRUB_HEADER, but halde_malloc() and halde_aligned_alloc() return cleared memory. */
+    HALDE_SCRUB_ON_ALLOCATE,
+};
+
+/*
+ * halde_set_scrub() is a non-standard function which selects what happens
+ * to freed memory. The default is HALDE_SCRUB_HEADER.
+ *
+ * Only HALDE_SCRUB_FULL makes freeing cost time proportional to the size
+ * of the block. In return, halde_calloc() needs not clear reused memory
+ * if HALDE_SCRUB_FULL is selected before the first allocation.
+ *
+ * HALDE_SCRUB_ON_ALLOCATE moves the cost to the allocation instead, and
+ * skips clearing memory that has never been handed out before.
+ */
+void halde_set_scrub(enum halde_scrub policy);
+
+/**
+ * Snapshot of the heap, see halde_stats().
+ */
+struct halde_stats {
+    /** Bytes taken by allocated blocks, including their headers. */
+    size_t bytes_in_use;
+    /** Bytes available in free blocks. */
+    size_t bytes_free;
+    size_t largest_free_block;
+    size_t free_blocks;
+    /** 1 - largest_free_block / bytes_free: 0 if all free memory is in one block, close to 1 if it is scattered. */
+    double fragmentation;
+    unsigned long long malloc_calls;
+    /** Time spent in halde_malloc(), in CPU time stamp counter cycles (nanoseconds where there is none). */
+    unsigned long long malloc_cycles;
+    unsigned long long free_calls;
+    unsigned long long free_cycles;
+    /** Searches for a large block, see halde_set_placement(), and the number of blocks they examined. */
+    unsigned long long searches;
+    unsigned long long search_steps;
+};
+
+/*
+ * halde_stats() is a non-standard function which fills in a snapshot of the
+ * heap and of the calls to halde_malloc() and halde_free() so far.
+ *
+ * The counters are maintained on every call and are cheap enough to stay
+ * enabled. Only computing largest_free_block walks the list of large
+ * blocks. With HALDE_THREADS, blocks in the thread caches count as in use,
+ * and other threads add their calls in batches of 64.
+ */
+void halde_stats(struct halde_stats* stats);
+
+/*
+ * halde_stats_json() writes the current statistics to stream as a single
+ * line of JSON.
+ */
+void halde_stats_json(FILE* stream);
+
+/*
+ * halde_stats_every() makes halde write the statistics to stream, like
+ * halde_stats_json(), after every interval calls to halde_malloc(). An
+ * interval of 0 stops the dumps.
+ */
+void halde_stats_every(FILE* stream, unsigned long interval);
@@ -1,64 +1,122 @@
 #include "argumentParser.h"
 
 #include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
 #include <string.h>
 
 #define UNINITIALIZED -1
 
 char** arguments;
-int optionIndex = UNINITIALIZED;
 int argumentCount = UNINITIALIZED;
-int combinedCount = UNINITIALIZED;
 
 char* command = NULL;
 
+/// An option of the command line. Key and value point into argv, which stays unmodified.
+struct option {
+    const char* key;
+    size_t keyLength;
+    char* value;
+    /// Position on the command line, occurrences of the same key are kept in this order.
+    int position;
+
+    /// The value as a number, parsed on the first request.
+    enum { UNPARSED, NUMBER, SUFFIXED_NUMBER, NOT_A_NUMBER } parsed;
+    long long number;
+    int error;
+};
+
+/// Options beyond this are not indexed, see initArgumentParser().
+#define MAX_INDEXED_OPTIONS 1024
+
+/// The options sorted by key, so that a key is found by binary search. The module must not allocate memory.
+static struct option options[MAX_INDEXED_OPTIONS];
+static int optionCount = 0;
+static bool indexed = false;
+
+/// Holds the option found without the index.
+static struct option unindexed;
+
 bool stringsEqual(const char* s1, const char* s2) {
     return strcmp(s1, s2) == 0;
 }
 
-static void splitOption(char** fullOption) {
-    char* equals = strchr(*fullOption, '=');
+static int compareKey(const struct option* option, const char* key, const size_t keyLength) {
+    const size_t shorter = option->keyLength < keyLength ? option->keyLength : keyLength;
+    const int order = memcmp(option->key, key, shorter);
 
-    // skip leading '-'
-    *fullOption += 1;
+    if (order != 0) {
+        return order;
+    }
 
-    // no equals in string, nothing to split
-    // most likely '-empty='
-    if (!equals) {
-        return;
+    return (option->keyLength > keyLength) - (option->keyLength < keyLength);
+}
+
+static int compareOptions(const void* a, const void* b) {
+    const struct option* first = a;
+    const struct option* second = b;
+
+    const int order = compareKey(first, second->key, second->keyLength);
+    if (order != 0) {
+        return order;
     }
 
-    // since strings are null terminated, adding a \0 in place of the '=' splits the string
-    *equals = '\0';
+    return (first->position > second->position) - (first->position < second->position);
+}
+
+/// Sort the options in place, qsort may allocate a buffer for arrays of this size.
+static void sortOptions(void) {
+    for (int i = 1; i < optionCount; i++) {
+        const struct option option = options[i];
+        int j = i;
+
+        for (; j > 0 && compareOptions(&options[j - 1], &option) > 0; j--) {
+            options[j] = options[j - 1];
+        }
+        options[j] = option;
+    }
+}
+
+/// Describe the option at the position among all options, without modifying it.
+static void setOption(struct option* option, const int position) {
+    char* fullOption = arguments[argumentCount + 1 + position];
+    char* equals = strchr(fullOption, '=');
+
+    // skip leading '-', the key ends at the '='
+    *option = (struct option){
+        .key = fullOption + 1,
+        .keyLength = equals - fullOption - 1,
+        .value = equals + 1,
+        .position = position,
+    };
 }
 
 int initArgumentParser(const int argc, char* argv[]) {
+    if (argc < 1 || argv == NULL) {
+        errno = EINVAL;
+        return PARSER_INIT_FAILURE;
+    }
+
     command = argv[0];
-    bool onlyOptions = false;
+    optionCount = 0;
+    indexed = false;
+    argumentCount = UNINITIALIZED;
 
     for (int i = 1; i < argc; i++) {
-        // no local variable for argv[i] as splitOption requires access to argv directly
-
         const bool startsWithDash = argv[i][0] == '-';
         const bool hasEquals = strchr(argv[i], '=') != NULL;
         const bool isOption = startsWithDash && hasEquals;
 
-        if (onlyOptions) {
+        if (argumentCount != UNINITIALIZED) {
             // an argument after an option
             if (!isOption) {
                 errno = EINVAL;
                 return PARSER_INIT_FAILURE;
             }
-            splitOption(&argv[i]);
-        } else {
+        } else if (isOption) {
             // the first option
             // everything else prior was an argument
-            if (isOption) {
-                onlyOptions = true;
-                argumentCount = i - 1;
-                optionIndex = i;
-                splitOption(&argv[i]);
-            }
+            argumentCount = i - 1;
         }
     }
 
@@ -68,7 +126,19 @@ int initArgumentParser(const int argc, char* argv[]) {
     }
 
     arguments = argv;
-    combinedCount = argc - 1;
+    optionCount = argc - 1 - argumentCount;
+
+    // that many options are looked up one after another, as without the index
+    indexed = optionCount <= MAX_INDEXED_OPTIONS;
+    if (!indexed) {
+        return PARSER_INIT_SUCCESS;
+    }
+
+    for (int i = 0; i < optionCount; i++) {
+        setOption(&options[i], i);
+    }
+
+    sortOptions();
 
     return PARSER_INIT_SUCCESS;
 }
@@ -89,20 +159,157 @@ char* getArgument(const int index) {
     return arguments[index + 1];
 }
 
-char* getValueForOption(const char* keyName) {
-    if (optionIndex == UNINITIALIZED) {
+/// The first occurrence of the key after the option at position previous, or NULL. Only used without the index.
+static struct option* scanOptions(const char* keyName, const int previous) {
+    const size_t keyLength = strlen(keyName);
+
+    for (int i = previous + 1; i < optionCount; i++) {
+        setOption(&unindexed, i);
+        if (compareKey(&unindexed, keyName, keyLength) == 0) {
+            return &unindexed;
+        }
+    }
+
+    return NULL;
+}
+
+/// The first occurrence of the key, or NULL.
+static struct option* findOption(const char* keyName) {
+    if (!indexed) {
+        return scanOptions(keyName, -1);
+    }
+
+    const size_t keyLength = strlen(keyName);
+    int low = 0;
+    int high = optionCount;
+
+    // lower bound, so that the first of several occurrences is found
+    while (low < high) {
+        const int middle = low + (high - low) / 2;
+
+        if (compareKey(&options[middle], keyName, keyLength) < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    if (low == optionCount || compareKey(&options[low], keyName, keyLength) != 0) {
         return NULL;
     }
 
-    for (int i = optionIndex; i <= combinedCount; i++) {
-        char* currentOptionName = arguments[i];
+    return &options[low];
+}
+
+char* getValueForOption(const char* keyName) {
+    const struct option* option = findOption(keyName);
 
-        if (stringsEqual(currentOptionName, keyName)) {
-            // the options are all split already
-            // move to the end of the name and go over the NULL
-            return currentOptionName + strlen(currentOptionName) + 1;
+    return option ? option->value : NULL;
+}
+
+char* getNextValueForOption(const char* keyName, const char* previous) {
+    const struct option* option = findOption(keyName);
+    if (option == NULL || previous == NULL) {
+        return option ? option->value : NULL;
+    }
+
+    if (!indexed) {
+        // the value is the text behind the '=' of the option it belongs to
+        while (option && option->value != previous) {
+            option = scanOptions(keyName, option->position);
+        }
+        option = option ? scanOptions(keyName, option->position) : NULL;
+
+        return option ? option->value : NULL;
+    }
+
+    // the occurrences of a key are next to each other, in the order of the command line
+    const size_t keyLength = strlen(keyName);
+    const struct option* end = options + optionCount;
+
+    for (; option < end && compareKey(option, keyName, keyLength) == 0; option++) {
+        if (option->value == previous) {
+            option++;
+            return option < end && compareKey(option, keyName, keyLength) == 0 ? option->value : NULL;
         }
     }
 
     return NULL;
 }
+
+static void parseNumber(struct option* option) {
+    const char* value = option->value;
+    char* end;
+
+    errno = 0;
+    long long number = strtoll(value, &end, 10);
+
+    option->parsed = NOT_A_NUMBER;
+    option->error = EINVAL;
+
+    if (end == value || errno == ERANGE) {
+        option->error = end == value ? EINVAL : ERANGE;
+        return;
+    }
+
+    int shift = 0;
+    switch (*end) {
+    case '\0':
+        break;
+    case 'K':
+        shift = 10;
+        break;
+    case 'M':
+        shift = 20;
+        break;
+    case 'G':
+        shift = 30;
+        break;
+    default:
+        return;
+    }
+
+    if (shift != 0) {
+        if (end[1] != '\0') {
+            return;
+        }
+        if (number > (LLONG_MAX >> shift) || number < (LLONG_MIN >> shift)) {
+            option->error = ERANGE;
+            return;
+        }
+        number *= 1LL << shift;
+    }
+
+    option->parsed = shift != 0 ? SUFFIXED_NUMBER : NUMBER;
+    option->number = number;
+    option->error = 0;
+}
+
+static int getNumber(const char* keyName, long long* value, const bool suffix) {
+    struct option* option = findOption(keyName);
+    if (option == NULL) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    if (option->parsed == UNPARSED) {
+        parseNumber(option);
+    }
+
+    if (option->parsed == NOT_A_NUMBER || (option->parsed == SUFFIXED_NUMBER && !suffix)) {
+        errno = option->parsed == NOT_A_NUMBER ? option->error : EINVAL;
+        return -1;
+    }
+
+    *value = option->number;
+
+    return 0;
+}
+
+int getIntegerForOption(const char* keyName, long long* value) {
+    return getNumber(keyName, value, false);
+}
+
+int getSizeForOption(const char* keyName, long long* value) {
+    return getNumber(keyName, value, true);
+}
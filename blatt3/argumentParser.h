@@ -27,6 +27,9 @@
  * After the command an arbitray number of arguments followed by an arbitrary
  * number of options can be specified. Both, arguments and options, are
  * optional.
+ *
+ * initArgumentParser() sorts the options by key once, so that every lookup
+ * is a binary search. Keys and values point into @c argv, nothing is copied.
  */
 
 /**
@@ -65,6 +68,41 @@ char* getCommand(void);
  */
 char* getValueForOption(const char* keyName);
 
+/**
+ * @brief Gets the value of the next occurrence of an option key.
+ *
+ * Iterates over all values of a key that may be given several times.
+ *
+ * @param keyName The key without leading dash.
+ * @param previous A value returned for the same key before, or @c NULL to
+ *                 start with the first occurrence.
+ * @return The value of the next occurrence after @a previous, or @c NULL if
+ *         there is none.
+ */
+char* getNextValueForOption(const char* keyName, const char* previous);
+
+/**
+ * @brief Gets the value of an option as an integer.
+ *
+ * The value is parsed on the first call and cached. It has to be a decimal
+ * number with an optional sign and nothing else.
+ *
+ * @param keyName The key without leading dash.
+ * @param value Receives the value of the first occurrence of the key.
+ * @return 0 on success. -1 if the option is missing, with @a errno set to
+ *         @c ENOENT, or if its value is not an integer, with @a errno set to
+ *         @c EINVAL or @c ERANGE.
+ */
+int getIntegerForOption(const char* keyName, long long* value);
+
+/**
+ * @brief Gets the value of an option as a size.
+ *
+ * Like getIntegerForOption(), but the number may be followed by one of the
+ * suffixes K, M and G, which multiply it by 1024, 1024^2 and 1024^3.
+ */
+int getSizeForOption(const char* keyName, long long* value);
+
 /**
  * @brief Retrieves the number of arguments.
  *
@@ -0,0 +1,424 @@
+// ptrace() options and __WALL
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ptrace.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/// Deepest tree the generator builds, the root has depth 0.
+#define MAX_DEPTH 16
+
+/// The word -line looks for. About one line in LINE_HIT_RATE contains it.
+#define NEEDLE "needle"
+#define LINE_HIT_RATE 50
+
+/// Shape of the synthetic tree.
+struct shape {
+    unsigned fanout;
+    unsigned depth;
+    unsigned files;
+    /// Average size of a file, the sizes are spread evenly between 0 and twice this.
+    unsigned size;
+};
+
+/// Number of files and directories at each depth, so that a run with -maxdepth knows how many entries it sees.
+static unsigned long entriesAt[MAX_DEPTH + 1];
+
+/// One crawl invocation of the benchmark.
+struct run {
+    const char* name;
+    /// Options after the directory, terminated by NULL. -maxdepth also limits the entries counted.
+    const char* options[8];
+    int maxDepth;
+};
+
+static const struct run runs[] = {
+    {"plain", {NULL}, -1},
+    {"name", {"-name=*.c", NULL}, -1},
+    {"names", {"-name=*.c", "-name=*.h", "-name=*.log", "-name=*.md", "-name=core.*", NULL}, -1},
+    {"size", {"-size=+1024", NULL}, -1},
+    {"line", {"-line=" NEEDLE, NULL}, -1},
+    {"maxdepth", {"-maxdepth=2", NULL}, 2},
+    {"all", {"-name=*.c", "-size=+512", "-line=" NEEDLE, "-maxdepth=3", NULL}, 3},
+    {"threads", {"-threads=4", NULL}, -1},
+};
+
+static const char* const extensions[] = {".c", ".h", ".txt", ".log", ".md", ".json", ".o", ""};
+
+static void die(const char* message) {
+    perror(message);
+    exit(EXIT_FAILURE);
+}
+
+/// xorshift64, so that a seed gives the same tree everywhere.
+static uint64_t rngState = 88172645463325252ULL;
+
+static uint32_t randomBelow(const uint32_t limit) {
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 7;
+    rngState ^= rngState << 17;
+
+    return rngState % limit;
+}
+
+/// Lines of random lowercase words, some of them containing NEEDLE.
+static void writeContent(const int fd, const size_t size) {
+    char* buffer = malloc(size + 1);
+    if (buffer == NULL) {
+        die("malloc");
+    }
+    size_t length = 0;
+
+    while (length < size) {
+        if (randomBelow(8 * LINE_HIT_RATE) == 0 && length + sizeof(NEEDLE) <= size) {
+            memcpy(buffer + length, NEEDLE " ", sizeof(NEEDLE));
+            length += sizeof(NEEDLE);
+            continue;
+        }
+
+        const size_t word = 1 + randomBelow(9);
+        for (size_t i = 0; i < word && length < size; i++) {
+            buffer[length++] = 'a' + randomBelow(26);
+        }
+        if (length < size) {
+            buffer[length++] = randomBelow(8) == 0 ? '\n' : ' ';
+        }
+    }
+
+    if (write(fd, buffer, length) != (ssize_t)length) {
+        die("write");
+    }
+    free(buffer);
+}
+
+static void generate(const char* path, const struct shape* shape, const unsigned depth) {
+    char child[PATH_MAX];
+
+    for (unsigned i = 0; i < shape->files; i++) {
+        const char* extension = extensions[randomBelow(sizeof(extensions) / sizeof(extensions[0]))];
+        snprintf(child, sizeof(child), "%s/%s%u%s", path, randomBelow(16) == 0 ? "core." : "file", i, extension);
+
+        const int fd = open(child, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            die(child);
+        }
+        writeContent(fd, randomBelow(2 * shape->size + 1));
+        close(fd);
+    }
+    entriesAt[depth + 1] += shape->files;
+
+    if (depth == shape->depth) {
+        return;
+    }
+
+    for (unsigned i = 0; i < shape->fanout; i++) {
+        snprintf(child, sizeof(child), "%s/dir%u", path, i);
+        if (mkdir(child, 0755) != 0) {
+            die(child);
+        }
+        generate(child, shape, depth + 1);
+    }
+    entriesAt[depth + 1] += shape->fanout;
+}
+
+static int removeEntry(const char* path, const struct stat* status, const int type, struct FTW* position) {
+    (void)status;
+    (void)type;
+    (void)position;
+
+    return remove(path);
+}
+
+static uint64_t now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+
+    return (uint64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+/// Start crawl on directory with the options of run, its output goes to /dev/null.
+static pid_t start(const char* crawl, const char* directory, const struct run* run, const bool traced) {
+    const pid_t pid = fork();
+    if (pid < 0) {
+        die("fork");
+    }
+    if (pid > 0) {
+        return pid;
+    }
+
+    const int null = open("/dev/null", O_WRONLY);
+    if (null < 0 || dup2(null, STDOUT_FILENO) < 0) {
+        die("/dev/null");
+    }
+    close(null);
+
+    const char* argv[sizeof(run->options) / sizeof(run->options[0]) + 3] = {crawl, directory};
+    for (size_t i = 0; run->options[i]; i++) {
+        argv[i + 2] = run->options[i];
+    }
+
+    if (traced) {
+        // wait until the parent has set the tracing options
+        if (ptrace(PTRACE_TRACEME, 0, NULL, NULL) != 0) {
+            die("ptrace");
+        }
+        raise(SIGSTOP);
+    }
+
+    execv(crawl, (char* const*)argv);
+    die(crawl);
+    return -1;
+}
+
+/// Run crawl once and return the wall time in ns. The peak RSS of crawl in KiB goes to rss.
+static uint64_t timeRun(const char* crawl, const char* directory, const struct run* run, long* rss) {
+    const uint64_t begin = now();
+    const pid_t pid = start(crawl, directory, run, false);
+
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0) {
+        die("wait4");
+    }
+    const uint64_t elapsed = now() - begin;
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+        fprintf(stderr, "%s: crawl failed\n", run->name);
+    }
+    *rss = usage.ru_maxrss;
+
+    return elapsed;
+}
+
+/**
+ * @brief Run crawl under ptrace and count the system calls of all its threads, or return -1 if tracing is not
+ * permitted.
+ *
+ * @details Every system call stops the thread on entry and on exit, so the count is half the number of stops. The
+ * few calls without an exit stop, like exit_group(), do not matter against the calls per entry.
+ */
+static long countSyscalls(const char* crawl, const char* directory, const struct run* run) {
+    const pid_t pid = start(crawl, directory, run, true);
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0) {
+        die("waitpid");
+    }
+    if (!WIFSTOPPED(status)) {
+        return -1;
+    }
+
+    const long options = PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_EXITKILL;
+    if (ptrace(PTRACE_SETOPTIONS, pid, NULL, (void*)options) != 0 || ptrace(PTRACE_SYSCALL, pid, NULL, NULL) != 0) {
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        return -1;
+    }
+
+    long stops = 0;
+    pid_t thread;
+    while ((thread = waitpid(-1, &status, __WALL)) > 0) {
+        if (!WIFSTOPPED(status)) {
+            if (thread == pid) {
+                break;
+            }
+            continue;
+        }
+
+        int signal = WSTOPSIG(status);
+        if (signal == (SIGTRAP | 0x80)) {
+            stops++;
+            signal = 0;
+        } else if (signal == SIGTRAP || signal == SIGSTOP) {
+            // clone events and the first stop of new threads
+            signal = 0;
+        }
+
+        ptrace(PTRACE_SYSCALL, thread, NULL, (void*)(long)signal);
+    }
+
+    // reap the threads that are still reported
+    while (waitpid(-1, &status, __WALL | WNOHANG) > 0) {
+    }
+
+    return stops / 2;
+}
+
+static unsigned long entriesWithin(const int maxDepth) {
+    unsigned long entries = 0;
+
+    for (int depth = 1; depth <= MAX_DEPTH && (maxDepth < 0 || depth <= maxDepth); depth++) {
+        entries += entriesAt[depth];
+    }
+
+    return entries;
+}
+
+static int compareTimes(const void* a, const void* b) {
+    const uint64_t x = *(const uint64_t*)a;
+    const uint64_t y = *(const uint64_t*)b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Time the run and print one line of results.
+ *
+ * @details The median of repetitions runs is reported, after one run that warms up the page cache. System calls are
+ * counted in an extra run under ptrace, minus those of a crawl of an empty directory, which are spent on startup.
+ */
+static void measure(const char* crawl, const char* directory, const struct run* run, const int repetitions,
+                    const long baseline) {
+    long rss;
+    timeRun(crawl, directory, run, &rss);
+
+    uint64_t times[repetitions];
+    long peakRss = 0;
+    for (int i = 0; i < repetitions; i++) {
+        times[i] = timeRun(crawl, directory, run, &rss);
+        if (rss > peakRss) {
+            peakRss = rss;
+        }
+    }
+    qsort(times, repetitions, sizeof(uint64_t), compareTimes);
+    const uint64_t median = times[repetitions / 2];
+
+    const unsigned long entries = entriesWithin(run->maxDepth);
+    const long syscalls = baseline >= 0 ? countSyscalls(crawl, directory, run) : -1;
+
+    printf("%-9s %9lu %9.1f %12.0f", run->name, entries, median / 1e6, entries / (median / 1e9));
+    if (syscalls >= 0) {
+        printf(" %9.2f", (double)(syscalls - baseline) / entries);
+    } else {
+        printf(" %9s", "-");
+    }
+    printf(" %9ld\n", peakRss);
+    fflush(stdout);
+}
+
+static void usage(const char* program) {
+    fprintf(stderr,
+            "Usage: %s [-f FANOUT] [-d DEPTH] [-n FILES] [-s SIZE] [-S SEED] [-r RUNS] [-t RUN] [-c CRAWL] [-k DIR]\n"
+            "  -f FANOUT subdirectories per directory (default 4)\n"
+            "  -d DEPTH  depth of the tree, at most %d (default 5)\n"
+            "  -n FILES  files per directory (default 20)\n"
+            "  -s SIZE   average file size in bytes (default 1024)\n"
+            "  -S SEED   seed for the tree\n"
+            "  -r RUNS   timed runs per option set, the median is reported (default 3)\n"
+            "  -t RUN    only this option set: plain, name, names, size, line, maxdepth, all or threads\n"
+            "  -c CRAWL  crawl binary to measure (default ./crawl)\n"
+            "  -k DIR    generate the tree in DIR and keep it instead of using a temporary directory\n",
+            program, MAX_DEPTH - 1);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char* argv[]) {
+    struct shape shape = {.fanout = 4, .depth = 5, .files = 20, .size = 1024};
+    int repetitions = 3;
+    const char* only = NULL;
+    const char* crawl = "./crawl";
+    const char* keep = NULL;
+
+    int option;
+    while ((option = getopt(argc, argv, "f:d:n:s:S:r:t:c:k:")) != -1) {
+        switch (option) {
+            case 'f':
+                shape.fanout = strtoul(optarg, NULL, 10);
+                break;
+            case 'd':
+                shape.depth = strtoul(optarg, NULL, 10);
+                break;
+            case 'n':
+                shape.files = strtoul(optarg, NULL, 10);
+                break;
+            case 's':
+                shape.size = strtoul(optarg, NULL, 10);
+                break;
+            case 'S':
+                // xorshift must not start with 0
+                rngState = strtoull(optarg, NULL, 10) | 1;
+                break;
+            case 'r':
+                repetitions = atoi(optarg);
+                break;
+            case 't':
+                only = optarg;
+                break;
+            case 'c':
+                crawl = optarg;
+                break;
+            case 'k':
+                keep = optarg;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if (optind != argc || shape.depth >= MAX_DEPTH || repetitions < 1) {
+        usage(argv[0]);
+    }
+
+    char temporary[] = "/tmp/crawlbench.XXXXXX";
+    const char* directory = keep;
+    if (keep) {
+        if (mkdir(keep, 0755) != 0 && errno != EEXIST) {
+            die(keep);
+        }
+    } else if ((directory = mkdtemp(temporary)) == NULL) {
+        die("mkdtemp");
+    }
+
+    char empty[PATH_MAX];
+    snprintf(empty, sizeof(empty), "%s/empty", directory);
+    char tree[PATH_MAX];
+    snprintf(tree, sizeof(tree), "%s/tree", directory);
+    if (mkdir(empty, 0755) != 0 || mkdir(tree, 0755) != 0) {
+        die(directory);
+    }
+
+    const uint64_t begin = now();
+    generate(tree, &shape, 0);
+    printf("tree %s: fanout %u, depth %u, %u files of %u bytes per directory, %lu entries, generated in %.0f ms\n",
+           tree, shape.fanout, shape.depth, shape.files, shape.size, entriesWithin(-1), (now() - begin) / 1e6);
+
+    const long baseline = countSyscalls(crawl, empty, &runs[0]);
+    if (baseline < 0) {
+        printf("ptrace is not permitted, system calls are not counted\n");
+    }
+
+    printf("%-9s %9s %9s %12s %9s %9s\n", "run", "entries", "ms", "entries/s", "sys/entry", "RSS KiB");
+
+    bool found = false;
+    for (size_t i = 0; i < sizeof(runs) / sizeof(runs[0]); i++) {
+        if (only && strcmp(only, runs[i].name) != 0) {
+            continue;
+        }
+        found = true;
+
+        measure(crawl, tree, &runs[i], repetitions, baseline);
+    }
+
+    if (!keep && nftw(directory, removeEntry, 16, FTW_DEPTH | FTW_PHYS) != 0) {
+        perror(directory);
+    }
+
+    if (!found) {
+        usage(argv[0]);
+    }
+
+    return EXIT_SUCCESS;
+}
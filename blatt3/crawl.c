@@ -1,18 +1,28 @@
-#define _DEFAULT_SOURCE
+// memmem()
+#define _GNU_SOURCE
 
 #include <dirent.h>
-#include <fnmatch.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
-#include <libgen.h>
 #include <limits.h>
+#include <pthread.h>
 #include <regex.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 #include "argumentParser.h"
+#include "crawlFilter.h"
+#include "crawlIndex.h"
 
 #define ONLY_FILE 1
 #define ONLY_DIRECTORY 2
@@ -21,143 +31,1587 @@
 static bool checkLineRegex = false;
 static bool checkNamePattern = false;
 
+/// Snapshot file of -index, NULL without an index.
+static const char* indexFile = NULL;
+
+/// Files larger than this are read line by line instead of being mapped.
+#define MAP_LIMIT ((off_t)1 << 30)
+
+/// Where a scan of a mapped file continues if the file shrinks under it, see matchLines(). NULL outside of a scan.
+static _Thread_local sigjmp_buf* mappedScan;
+
+/// A string every line matching -line contains, see requiredLiteral(). Lines without it skip the regex.
+static char* lineLiteral;
+static size_t lineLiteralLength;
+
+struct worker;
+
+/// Output of a directory in ordered mode up to the point where a subdirectory was found.
+struct segment {
+    char* text;
+    size_t length;
+    /// The subdirectory found after the text, NULL for the last segment.
+    struct task* child;
+};
+
+/// A directory whose entries are crawled by one of the workers.
+struct task {
+    char* path;
+    int maxDepth;
+    /// The worker running the task, subdirectories go onto its deque.
+    struct worker* worker;
+
+    /// Everything the task prints goes to this stream first.
+    FILE* output;
+    char* text;
+    size_t length;
+
+    /// Ordered mode keeps the output until it is printed in the sequential order.
+    struct segment* segments;
+    size_t segmentCount;
+    size_t segmentCapacity;
+    bool done;
+};
+
+/// Tasks of a worker. The owner takes the newest one, other workers steal the oldest one.
+struct worker {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    struct task** tasks;
+    size_t first;
+    size_t end;
+    size_t capacity;
+};
+
+/// The thread pool of -threads=N, together with the filters all workers apply.
+static struct {
+    struct worker* workers;
+    int count;
+    bool ordered;
+
+    /// Tasks not yet finished. The pool is done once this drops to 0.
+    atomic_size_t pending;
+
+    /// Idle workers sleep until generation changes, i.e. until tasks are pushed or all are finished.
+    pthread_mutex_t idleMutex;
+    pthread_cond_t idleCondition;
+    atomic_int sleepers;
+    unsigned long generation;
+
+    /// Finished tasks are announced here in ordered mode.
+    pthread_mutex_t doneMutex;
+    pthread_cond_t doneCondition;
+
+    char type;
+    off_t size;
+    regex_t* lineRegex;
+} pool = {
+    .idleMutex = PTHREAD_MUTEX_INITIALIZER,
+    .idleCondition = PTHREAD_COND_INITIALIZER,
+    .doneMutex = PTHREAD_MUTEX_INITIALIZER,
+    .doneCondition = PTHREAD_COND_INITIALIZER,
+};
+
+/// Number of files the walker may hand to the scanners before it waits for them.
+#define SCAN_QUEUE_SIZE 256
+
+/// A file found by the walker, whose lines are searched by one of the scanners of -scanners=N.
+struct scanJob {
+    char* path;
+    int fd;
+    struct stat status;
+    /// Position in the walk, for printing in order.
+    unsigned long sequence;
+    char* text;
+    size_t length;
+    /// Finished jobs waiting for the ones before them in ordered mode.
+    struct scanJob* next;
+};
+
+/// The scanner threads and the bounded queue the walker fills.
+static struct {
+    pthread_t* threads;
+    int count;
+    bool ordered;
+    regex_t* lineRegex;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t notEmpty;
+    pthread_cond_t notFull;
+    struct scanJob* queue[SCAN_QUEUE_SIZE];
+    size_t first;
+    size_t queued;
+    /// Jobs queued, being scanned, or waiting to be printed. The walker waits while this is SCAN_QUEUE_SIZE.
+    size_t inFlight;
+    bool closed;
+
+    unsigned long nextSequence;
+    unsigned long nextToPrint;
+    struct scanJob* finished;
+} scanner = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .notEmpty = PTHREAD_COND_INITIALIZER,
+    .notFull = PTHREAD_COND_INITIALIZER,
+};
+
+/// Results are collected until this many bytes can be written at once.
+#define WRITE_BATCH_SIZE (256 * 1024)
+
+/// Most buffers a single writev() gets.
+#define WRITE_BATCH_CHUNKS 64
+
+/// Terminates every path printed, '\0' with -print0.
+static char pathTerminator = '\n';
+
+/**
+ * Output stage: the buffers of results are handed over instead of being copied, and written together with one
+ * writev() once enough has been collected.
+ */
+static struct {
+    pthread_mutex_t mutex;
+    struct iovec chunks[WRITE_BATCH_CHUNKS];
+    /// The buffers to free, as the chunks move forward on partial writes.
+    char* buffers[WRITE_BATCH_CHUNKS];
+    int count;
+    size_t bytes;
+} writer = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/// Results of the sequential walk, handed to the writer whenever WRITE_BATCH_SIZE bytes are collected.
+static FILE* results = NULL;
+static char* resultsText = NULL;
+static size_t resultsLength;
+
+static void die(const char* message) {
+    perror(message);
+    exit(EXIT_FAILURE);
+}
+
+/// Write all collected chunks and free them. The writer's mutex must be held.
+static void flushWriter(void) {
+    struct iovec* chunks = writer.chunks;
+    int count = writer.count;
+
+    while (count > 0) {
+        const ssize_t written = writev(STDOUT_FILENO, chunks, count);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            die("write");
+        }
+
+        // skip what was written, the first remaining chunk may be written partly
+        size_t rest = written;
+        while (count > 0 && rest >= chunks->iov_len) {
+            rest -= chunks->iov_len;
+            chunks++;
+            count--;
+        }
+        if (count > 0) {
+            chunks->iov_base = (char*)chunks->iov_base + rest;
+            chunks->iov_len -= rest;
+        }
+    }
+
+    for (int i = 0; i < writer.count; i++) {
+        free(writer.buffers[i]);
+    }
+    writer.count = 0;
+    writer.bytes = 0;
+}
+
+/// Hand the malloc'ed text over to the writer. Texts are written in the order they are handed over.
+static void writeChunk(char* text, const size_t length) {
+    if (length == 0) {
+        free(text);
+        return;
+    }
+
+    pthread_mutex_lock(&writer.mutex);
+    if (writer.count == WRITE_BATCH_CHUNKS) {
+        flushWriter();
+    }
+
+    writer.chunks[writer.count] = (struct iovec){text, length};
+    writer.buffers[writer.count] = text;
+    writer.count++;
+    writer.bytes += length;
+
+    if (writer.bytes >= WRITE_BATCH_SIZE) {
+        flushWriter();
+    }
+    pthread_mutex_unlock(&writer.mutex);
+}
+
+static void openResults(void) {
+    results = open_memstream(&resultsText, &resultsLength);
+    if (results == NULL) {
+        die("open_memstream");
+    }
+}
+
+/// Hand the results of the sequential walk to the writer once there are enough of them, or if all is true.
+static void batchResults(const bool all) {
+    if (results == NULL || (!all && ftello(results) < WRITE_BATCH_SIZE)) {
+        return;
+    }
+
+    fclose(results);
+    writeChunk(resultsText, resultsLength);
+    openResults();
+}
+
+/// Write everything still collected, at the end of the program.
+static void closeWriter(void) {
+    batchResults(true);
+    fclose(results);
+    free(resultsText);
+    results = NULL;
+
+    pthread_mutex_lock(&writer.mutex);
+    flushWriter();
+    pthread_mutex_unlock(&writer.mutex);
+}
+
+/// Print a path that matches all filters.
+static void printPath(FILE* output, const char* path) {
+    fputs(path, output);
+    putc(pathTerminator, output);
+
+    if (output == results) {
+        batchResults(false);
+    }
+}
+
 static int isSet(const int value, const int flag) {
     return (value & flag) == flag;
 }
 
-static bool isValidPath(const char* path) {
-    struct stat status;
-    lstat(path, &status);
+/// Name of a regular file given as argument. Entries found in a directory already have their name in d_name.
+static bool matchPathName(const char* path) {
+    const char* slash = strrchr(path, '/');
 
-    return S_ISDIR(status.st_mode) || S_ISREG(status.st_mode);
+    return matchNameFilter(slash ? slash + 1 : path);
 }
 
-static bool isFile(const char* path) {
-    struct stat status;
-    lstat(path, &status);
+/**
+ * @brief Longest string that every match of the extended regex pattern contains, written to literal.
+ *
+ * @details Only characters outside of groups and bracket expressions count, and none at all if the pattern has an
+ * alternative at the top level. Returns the length of the string, 0 if there is none.
+ */
+static size_t requiredLiteral(const char* pattern, char* literal) {
+    char run[strlen(pattern) + 1];
+    size_t runLength = 0;
+    size_t bestLength = 0;
+    int depth = 0;
+
+    for (size_t i = 0;; i++) {
+        const char c = pattern[i];
+        bool breaksRun = true;
+
+        if (c == '[') {
+            // skip the bracket expression, a ']' right at its start is part of it
+            i++;
+            if (pattern[i] == '^') {
+                i++;
+            }
+            if (pattern[i] == ']') {
+                i++;
+            }
+            while (pattern[i] && pattern[i] != ']') {
+                if (pattern[i] == '[' && pattern[i + 1] && strchr(":.=", pattern[i + 1])) {
+                    const char* close = strchr(pattern + i + 2, ']');
+                    i = close ? (size_t)(close - pattern) : i + 1;
+                }
+                i++;
+            }
+            if (!pattern[i]) {
+                return 0;
+            }
+        } else if (c == '(' || c == ')') {
+            depth += c == '(' ? 1 : -1;
+        } else if (c == '|' && depth == 0) {
+            return 0;
+        } else if (depth > 0 || c == '.' || c == '^' || c == '$') {
+            // within a group, skip escaped characters so that an escaped parenthesis does not count
+            if (c == '\\' && pattern[i + 1]) {
+                i++;
+            }
+        } else if (c == '*' || c == '?' || c == '{') {
+            // the character in front is optional
+            if (runLength > 0) {
+                runLength--;
+            }
+            if (c == '{') {
+                while (pattern[i] && pattern[i] != '}') {
+                    i++;
+                }
+            }
+        } else if (c == '+') {
+            // the character in front is required, but may repeat
+        } else if (c == '\\') {
+            const char next = pattern[i + 1];
+            if (next && strchr(".[]()*+?{}|^$\\", next)) {
+                run[runLength++] = next;
+                breaksRun = false;
+            }
+            if (next) {
+                i++;
+            }
+        } else if (c != '\0') {
+            run[runLength++] = c;
+            breaksRun = false;
+        }
+
+        if (breaksRun) {
+            if (runLength > bestLength) {
+                bestLength = runLength;
+                memcpy(literal, run, runLength);
+            }
+            runLength = 0;
+        }
+
+        if (!pattern[i]) {
+            break;
+        }
+    }
 
-    return S_ISREG(status.st_mode);
+    return bestLength;
 }
 
-static int matchName(const char* name, const char* pattern) {
-    char copy[strlen(name)];
-    strcpy(copy, name);
+/**
+ * @brief Absolute path of the file fileName.
+ *
+ * @details Only the directory is resolved, and only once for all files of the same directory in a row. The file
+ * itself is a regular file and needs no resolution.
+ */
+static void resolvePath(const char* fileName, char* absolutePath) {
+    // each scanner thread has its own
+    static _Thread_local char directory[PATH_MAX];
+    static _Thread_local char resolvedDirectory[PATH_MAX];
+
+    const char* slash = strrchr(fileName, '/');
+    const size_t directoryLength = slash ? (size_t)(slash - fileName) : 0;
+
+    if (slash == NULL || directoryLength == 0 || directoryLength >= PATH_MAX) {
+        realpath(fileName, absolutePath);
+        return;
+    }
 
-    const char* buf = basename(copy);
+    if (strncmp(directory, fileName, directoryLength) != 0 || directory[directoryLength] != '\0') {
+        memcpy(directory, fileName, directoryLength);
+        directory[directoryLength] = '\0';
 
-    return fnmatch(pattern, buf, 0) == 0;
-}
+        if (realpath(directory, resolvedDirectory) == NULL) {
+            directory[0] = '\0';
+            realpath(fileName, absolutePath);
+            return;
+        }
+    }
 
-static int getFileSize(FILE* file) {
-    if (file == NULL) {
-        return 0;
+    // the root directory is the only one ending with a slash
+    const size_t resolvedLength = stringsEqual(resolvedDirectory, "/") ? 0 : strlen(resolvedDirectory);
+    const size_t nameLength = strlen(slash + 1);
+    if (resolvedLength + nameLength + 2 > PATH_MAX) {
+        realpath(fileName, absolutePath);
+        return;
     }
 
-    const int currentPosition = ftell(file);
+    memcpy(absolutePath, resolvedDirectory, resolvedLength);
+    absolutePath[resolvedLength] = '/';
+    memcpy(absolutePath + resolvedLength + 1, slash + 1, nameLength + 1);
+}
 
-    fseek(file, 0, SEEK_END);
+/// Print line if it matches. Resolves the absolute path of the file on the first match.
+static void matchLine(const char* fileName, char* absolutePath, bool* matchFound, const int lineNumber,
+                      const char* line, const regex_t* line_regex, FILE* output) {
+    if (regexec(line_regex, line, 0, NULL, 0) != 0) {
+        return;
+    }
 
-    const int fileSize = ftell(file);
+    // only resolve the path of files which actually match
+    if (!*matchFound) {
+        resolvePath(fileName, absolutePath);
+    }
 
-    fseek(file, 0, currentPosition);
+    *matchFound = true;
 
-    return fileSize;
+    fprintf(output, "%s:%d:%s", absolutePath, lineNumber, line);
 }
 
-static bool matchLines(const char* fileName, FILE* fp, const regex_t* line_regex) {
+/// Read the file line by line, for files which cannot be mapped.
+static bool matchStream(const char* fileName, FILE* fp, const regex_t* line_regex, FILE* output) {
     char absolutePath[PATH_MAX];
-    realpath(fileName, absolutePath);
 
     char* line = NULL;
     size_t length = 0; // unused, but required
+    ssize_t lineLength;
 
     bool matchFound = false;
 
     int lineNumber = 0;
-    while (getline(&line, &length, fp) != -1) {
+    while ((lineLength = getline(&line, &length, fp)) != -1) {
         lineNumber++;
-        const int result = regexec(line_regex, line, 0, NULL, 0);
 
-        if (result != 0) {
+        if (lineLiteral && !memmem(line, lineLength, lineLiteral, lineLiteralLength)) {
             continue;
         }
 
-        matchFound = true;
+        matchLine(fileName, absolutePath, &matchFound, lineNumber, line, line_regex, output);
+    }
+
+    free(line);
+
+    return matchFound;
+}
+
+/// State of matchMapped() that outlives a scan cut short by SIGBUS. It lives on the heap, as locals changed after
+/// sigsetjmp() are indeterminate once siglongjmp() returned there.
+struct mappedState {
+    char* line;
+    size_t capacity;
+    bool matchFound;
+};
+
+/**
+ * @brief Search the mapped file of the given size.
+ *
+ * @details With a required literal, memmem jumps from one occurrence to the next and only the lines containing one
+ * are given to the regex. Line numbers are counted with memchr in between.
+ */
+static void matchMapped(const char* fileName, const char* data, const size_t size, const regex_t* line_regex,
+                        FILE* output, struct mappedState* state) {
+    char absolutePath[PATH_MAX];
+    const char* end = data + size;
+    const char* position = data;
+    int lineNumber = 1;
+
+    while (position < end) {
+        const char* lineStart = position;
+
+        if (lineLiteral) {
+            const char* hit = memmem(position, end - position, lineLiteral, lineLiteralLength);
+            if (hit == NULL) {
+                break;
+            }
+
+            const char* newline;
+            while ((newline = memchr(lineStart, '\n', hit - lineStart)) != NULL) {
+                lineNumber++;
+                lineStart = newline + 1;
+            }
+        }
+
+        const char* newline = memchr(lineStart, '\n', end - lineStart);
+        const char* lineEnd = newline ? newline + 1 : end;
+
+        // the regex needs a terminated string, and gets the newline just like from getline()
+        const size_t length = lineEnd - lineStart;
+        if (length + 1 > state->capacity) {
+            state->capacity = length + 1 > 2 * state->capacity ? length + 1 : 2 * state->capacity;
+            state->line = realloc(state->line, state->capacity);
+            if (state->line == NULL) {
+                die("realloc");
+            }
+        }
+        memcpy(state->line, lineStart, length);
+        state->line[length] = '\0';
+
+        matchLine(fileName, absolutePath, &state->matchFound, lineNumber, state->line, line_regex, output);
+
+        lineNumber++;
+        position = lineEnd;
+    }
+}
+
+/// Ends the scan of a mapped file that was truncated while crawl read it. Any other SIGBUS is fatal as usual.
+static void handleBusError(const int signal) {
+    if (mappedScan == NULL) {
+        // the access is repeated on return and now kills crawl
+        sigaction(signal, &(struct sigaction){.sa_handler = SIG_DFL}, NULL);
+        return;
+    }
+
+    siglongjmp(*mappedScan, 1);
+}
+
+/// Install handleBusError(). The signal is not blocked within the handler, so no mask needs to be restored after
+/// jumping out of it.
+static void catchBusErrors(void) {
+    struct sigaction action = {.sa_handler = handleBusError, .sa_flags = SA_NODEFER};
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGBUS, &action, NULL) != 0) {
+        die("sigaction");
+    }
+}
+
+/// Print the lines of the opened file that match, and close fd.
+static bool matchLines(const char* fileName, const int fd, const struct stat* status, const regex_t* line_regex,
+                       FILE* output) {
+    if (S_ISREG(status->st_mode) && status->st_size > 0 && status->st_size <= MAP_LIMIT) {
+        void* data = mmap(NULL, status->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (data != MAP_FAILED) {
+            close(fd);
+            madvise(data, status->st_size, MADV_SEQUENTIAL);
+
+            // a file truncated during the scan ends where its pages are gone, just like a short read
+            struct mappedState* state = calloc(1, sizeof(struct mappedState));
+            if (state == NULL) {
+                die("calloc");
+            }
+
+            sigjmp_buf truncated;
+            if (sigsetjmp(truncated, 0) == 0) {
+                mappedScan = &truncated;
+                matchMapped(fileName, data, status->st_size, line_regex, output, state);
+            }
+            mappedScan = NULL;
 
-        printf("%s:%d:%s", absolutePath, lineNumber, line);
+            munmap(data, status->st_size);
+
+            const bool matchFound = state->matchFound;
+            free(state->line);
+            free(state);
+
+            return matchFound;
+        }
     }
 
+    FILE* fp = fdopen(fd, "r");
+    if (fp == NULL) {
+        close(fd);
+        return false;
+    }
+
+    const bool matchFound = matchStream(fileName, fp, line_regex, output);
+    fclose(fp);
+
     return matchFound;
 }
 
-static int checkFile(const char* file, const char pattern[], const off_t size, const regex_t* line_regex) {
-    FILE* fp = fopen(file, "r");
+/// Hand the opened file to the scanners, waiting while too many files are in flight.
+static void submitScan(const char* path, const int fd, const struct stat* status) {
+    struct scanJob* job = calloc(1, sizeof(struct scanJob));
+    if (job == NULL || (job->path = strdup(path)) == NULL) {
+        die("malloc");
+    }
+    job->fd = fd;
+    job->status = *status;
+
+    pthread_mutex_lock(&scanner.mutex);
+    while (scanner.inFlight == SCAN_QUEUE_SIZE) {
+        pthread_cond_wait(&scanner.notFull, &scanner.mutex);
+    }
+
+    job->sequence = scanner.nextSequence++;
+    scanner.queue[(scanner.first + scanner.queued) % SCAN_QUEUE_SIZE] = job;
+    scanner.queued++;
+    scanner.inFlight++;
+
+    pthread_cond_signal(&scanner.notEmpty);
+    pthread_mutex_unlock(&scanner.mutex);
+}
+
+static void freeScanJob(struct scanJob* job) {
+    free(job->text);
+    free(job->path);
+    free(job);
+}
+
+/// Print the output of the job, in ordered mode together with all finished jobs that were waiting for it.
+static void finishScan(struct scanJob* job) {
+    pthread_mutex_lock(&scanner.mutex);
+
+    if (!scanner.ordered) {
+        scanner.inFlight--;
+        pthread_cond_signal(&scanner.notFull);
+        pthread_mutex_unlock(&scanner.mutex);
+
+        // one chunk per file keeps its lines together
+        writeChunk(job->text, job->length);
+        job->text = NULL;
+        freeScanJob(job);
+        return;
+    }
+
+    job->next = scanner.finished;
+    scanner.finished = job;
+
+    // there are at most SCAN_QUEUE_SIZE finished jobs, so searching the list is cheap
+    for (bool printed = true; printed;) {
+        printed = false;
+
+        for (struct scanJob** link = &scanner.finished; *link; link = &(*link)->next) {
+            struct scanJob* current = *link;
+            if (current->sequence != scanner.nextToPrint) {
+                continue;
+            }
+
+            *link = current->next;
+            writeChunk(current->text, current->length);
+            current->text = NULL;
+            freeScanJob(current);
+
+            scanner.nextToPrint++;
+            scanner.inFlight--;
+            printed = true;
+            break;
+        }
+    }
+
+    pthread_cond_signal(&scanner.notFull);
+    pthread_mutex_unlock(&scanner.mutex);
+}
+
+static void* scan(void* argument) {
+    (void)argument;
+
+    while (true) {
+        pthread_mutex_lock(&scanner.mutex);
+        while (scanner.queued == 0 && !scanner.closed) {
+            pthread_cond_wait(&scanner.notEmpty, &scanner.mutex);
+        }
+        if (scanner.queued == 0) {
+            pthread_mutex_unlock(&scanner.mutex);
+            return NULL;
+        }
+
+        struct scanJob* job = scanner.queue[scanner.first];
+        scanner.first = (scanner.first + 1) % SCAN_QUEUE_SIZE;
+        scanner.queued--;
+        pthread_mutex_unlock(&scanner.mutex);
+
+        FILE* output = open_memstream(&job->text, &job->length);
+        if (output == NULL) {
+            die("open_memstream");
+        }
+        matchLines(job->path, job->fd, &job->status, scanner.lineRegex, output);
+        fclose(output);
 
-    const int fileSize = getFileSize(fp);
+        finishScan(job);
+    }
+}
+
+static void startScanners(void) {
+    scanner.threads = calloc(scanner.count, sizeof(pthread_t));
+    if (scanner.threads == NULL) {
+        die("calloc");
+    }
+
+    for (int i = 0; i < scanner.count; i++) {
+        errno = pthread_create(&scanner.threads[i], NULL, scan, NULL);
+        if (errno != 0) {
+            die("pthread_create");
+        }
+    }
+}
+
+/// Wait until the scanners have searched and printed all files.
+static void stopScanners(void) {
+    pthread_mutex_lock(&scanner.mutex);
+    scanner.closed = true;
+    pthread_cond_broadcast(&scanner.notEmpty);
+    pthread_mutex_unlock(&scanner.mutex);
+
+    for (int i = 0; i < scanner.count; i++) {
+        pthread_join(scanner.threads[i], NULL);
+    }
+
+    free(scanner.threads);
+}
 
-    const bool nameMatches = checkNamePattern ? matchName(file, pattern) : true;
+/**
+ * @brief Check size and lines of the regular file name, relative to the directory directoryFd.
+ *
+ * @details status may be NULL if the file has not been stat'ed yet. It is then only stat'ed if -size or -line needs it,
+ * using the descriptor if the file is opened for -line anyway.
+ */
+static int checkFile(const int directoryFd, const char* name, const char* path, const struct stat* status,
+                     const off_t size, const regex_t* line_regex, FILE* output) {
+    int fd = -1;
+    if (checkLineRegex && (fd = openat(directoryFd, name, O_RDONLY)) < 0) {
+        return false;
+    }
+
+    struct stat fileStatus;
+    if ((size != 0 || fd >= 0) && status == NULL) {
+        const int result =
+            fd >= 0 ? fstat(fd, &fileStatus) : fstatat(directoryFd, name, &fileStatus, AT_SYMLINK_NOFOLLOW);
+        if (result != 0) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            return false;
+        }
+        status = &fileStatus;
+    }
+
+    const off_t fileSize = status ? status->st_size : 0;
     const bool sizeMatches = size == 0 || (size >= 0 ? fileSize > size : fileSize < -size);
 
-    if (checkLineRegex && nameMatches && sizeMatches) {
-        matchLines(file, fp, line_regex);
+    if (fd >= 0 && sizeMatches && scanner.count > 0) {
+        submitScan(path, fd, status);
+    } else if (fd >= 0 && sizeMatches) {
+        matchLines(path, fd, status, line_regex, output);
+        if (output == results) {
+            batchResults(false);
+        }
+    } else if (fd >= 0) {
+        close(fd);
     }
 
-    fclose(fp);
+    return !checkLineRegex && sizeMatches;
+}
+
+static void spawn(struct task* parent, const char* path, int maxDepth);
+
+/// At most this many directories stay open while walking down, the entries left in older ones are read into memory.
+#define MAX_OPEN_DIRECTORIES 64
+
+/// A directory on the stack of crawlDirectory().
+struct frame {
+    /// NULL once the entries left have been drained into rest.
+    DIR* directory;
+    /// Descriptor of a drained directory, opened again while its entries are handled, -1 otherwise.
+    int fd;
+    /// Entries of a drained directory: the d_type byte followed by the name, one after another.
+    char* rest;
+    size_t restLength;
+    size_t restCapacity;
+    size_t restPosition;
+    /// Length of the path of the directory within the path buffer.
+    size_t pathLength;
+    int maxDepth;
+};
+
+/// The directories from the argument down to the current one, and the path of the current entry.
+struct walk {
+    struct frame* frames;
+    size_t depth;
+    size_t capacity;
+    /// Number of frames whose directory is open, and number of frames at the bottom that have been drained.
+    int open;
+    size_t drained;
+
+    char* path;
+    size_t pathCapacity;
+};
+
+static void* grow(void* array, size_t* capacity, const size_t needed, const size_t elementSize) {
+    if (needed <= *capacity) {
+        return array;
+    }
+
+    size_t newCapacity = *capacity ? *capacity * 2 : 64;
+    while (newCapacity < needed) {
+        newCapacity *= 2;
+    }
 
-    return !checkLineRegex && nameMatches && sizeMatches;
+    array = realloc(array, newCapacity * elementSize);
+    if (array == NULL) {
+        die("realloc");
+    }
+    *capacity = newCapacity;
+
+    return array;
 }
 
-static void crawl(char* path, const int maxDepth, const char pattern[], const char type, const int _, const off_t size,
-                  regex_t* line_regex) {
+/// Write "/name" behind the first prefixLength bytes of path, growing it as needed.
+static void appendName(char** path, size_t* capacity, const size_t prefixLength, const char* name) {
+    const size_t nameLength = strlen(name);
+
+    *path = grow(*path, capacity, prefixLength + nameLength + 2, 1);
+    (*path)[prefixLength] = '/';
+    memcpy(*path + prefixLength + 1, name, nameLength + 1);
+}
+
+/**
+ * @brief Open the directory path, also if it is longer than PATH_MAX.
+ *
+ * @details Such a path is opened piece by piece, each relative to the previous one.
+ */
+static int openDirectory(char* path) {
+    int fd = AT_FDCWD;
+    char* start = path;
+
+    while (strlen(start) >= PATH_MAX) {
+        // cut at the last slash that keeps the piece short enough
+        char* cut = start + PATH_MAX - 1;
+        while (cut > start && *cut != '/') {
+            cut--;
+        }
+        if (cut == start) {
+            if (fd != AT_FDCWD) {
+                close(fd);
+            }
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+
+        *cut = '\0';
+        const int next = openat(fd, start, O_RDONLY | O_DIRECTORY);
+        *cut = '/';
+
+        if (fd != AT_FDCWD) {
+            close(fd);
+        }
+        if (next < 0) {
+            return -1;
+        }
+
+        fd = next;
+        start = cut + 1;
+        while (*start == '/') {
+            start++;
+        }
+    }
+
+    const int result = openat(fd, start, O_RDONLY | O_DIRECTORY);
+    if (fd != AT_FDCWD) {
+        close(fd);
+    }
+
+    return result;
+}
+
+/// Like lstat(), but also for a path longer than PATH_MAX, see openDirectory().
+static int statPath(char* path, struct stat* status) {
+    if (strlen(path) < PATH_MAX) {
+        return lstat(path, status);
+    }
+
+    char* slash = strrchr(path, '/');
+    if (slash == NULL) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    *slash = '\0';
+    const int fd = openDirectory(path);
+    *slash = '/';
+    if (fd < 0) {
+        return -1;
+    }
+
+    const int result = fstatat(fd, slash + 1, status, AT_SYMLINK_NOFOLLOW);
+    close(fd);
+
+    return result;
+}
+
+static bool isDotOrDotDot(const char* name) {
+    return stringsEqual(name, ".") || stringsEqual(name, "..");
+}
+
+/// Read the entries left in the oldest open directory into memory and close it.
+static void drainOldest(struct walk* walk) {
+    while (walk->frames[walk->drained].directory == NULL) {
+        walk->drained++;
+    }
+
+    struct frame* frame = &walk->frames[walk->drained++];
+    struct dirent* entry;
+
+    while ((entry = readdir(frame->directory)) != NULL) {
+        if (isDotOrDotDot(entry->d_name)) {
+            continue;
+        }
+
+        const size_t length = strlen(entry->d_name) + 1;
+        frame->rest = grow(frame->rest, &frame->restCapacity, frame->restLength + length + 1, 1);
+        frame->rest[frame->restLength] = (char)entry->d_type;
+        memcpy(frame->rest + frame->restLength + 1, entry->d_name, length);
+        frame->restLength += length + 1;
+    }
+
+    closedir(frame->directory);
+    frame->directory = NULL;
+    walk->open--;
+}
+
+static void pushFrame(struct walk* walk, DIR* directory, const size_t pathLength, const int maxDepth) {
+    walk->frames = grow(walk->frames, &walk->capacity, walk->depth + 1, sizeof(struct frame));
+    walk->frames[walk->depth++] = (struct frame){
+        .directory = directory,
+        .fd = -1,
+        .pathLength = pathLength,
+        .maxDepth = maxDepth,
+    };
+
+    if (++walk->open > MAX_OPEN_DIRECTORIES) {
+        drainOldest(walk);
+    }
+}
+
+static void popFrame(struct walk* walk) {
+    struct frame* frame = &walk->frames[--walk->depth];
+
+    if (frame->directory) {
+        closedir(frame->directory);
+        walk->open--;
+    }
+    if (frame->fd >= 0) {
+        close(frame->fd);
+    }
+    free(frame->rest);
+
+    if (walk->drained > walk->depth) {
+        walk->drained = walk->depth;
+    }
+}
+
+/// The next entry of the directory, false once all entries have been handled.
+static bool nextEntry(struct frame* frame, const char** name, unsigned char* type) {
+    if (frame->directory) {
+        struct dirent* entry;
+
+        while ((entry = readdir(frame->directory)) != NULL) {
+            if (!isDotOrDotDot(entry->d_name)) {
+                *name = entry->d_name;
+                *type = entry->d_type;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    if (frame->restPosition >= frame->restLength) {
+        return false;
+    }
+
+    *type = (unsigned char)frame->rest[frame->restPosition];
+    *name = frame->rest + frame->restPosition + 1;
+    frame->restPosition += strlen(*name) + 2;
+
+    return true;
+}
+
+/**
+ * @brief Handle an entry of the directory directoryFd, whose path is path.
+ *
+ * @details The type comes from d_type. Only if the file system does not provide it, or if -size needs the size,
+ * the entry is stat'ed, relative to the directory so the path is not resolved again.
+ *
+ * Returns the opened subdirectory if its entries are to be crawled next, NULL otherwise.
+ */
+static DIR* crawlEntry(const int directoryFd, const char* name, unsigned char entryType, const char* path,
+                       const int maxDepth, const char type, struct task* task, const off_t size,
+                       regex_t* line_regex) {
     if (maxDepth < 0) {
-        return;
+        return NULL;
     }
 
-    if (!isValidPath(path)) {
-        return;
+    struct stat status;
+    bool statted = false;
+
+    if (entryType == DT_UNKNOWN) {
+        if (fstatat(directoryFd, name, &status, AT_SYMLINK_NOFOLLOW) != 0) {
+            return NULL;
+        }
+        entryType = S_ISREG(status.st_mode) ? DT_REG : S_ISDIR(status.st_mode) ? DT_DIR : DT_UNKNOWN;
+        statted = true;
     }
 
-    if (isFile(path)) {
-        if (isSet(type, ONLY_FILE) && checkFile(path, pattern, size, line_regex)) {
-            printf("%s\n", path);
+    FILE* output = task ? task->output : results;
+
+    if (entryType == DT_REG) {
+        if (isSet(type, ONLY_FILE) && (!checkNamePattern || matchNameFilter(name)) &&
+            checkFile(directoryFd, name, path, statted ? &status : NULL, size, line_regex, output)) {
+            printPath(output, path);
         }
-        return;
+        return NULL;
+    }
+
+    if (entryType != DT_DIR) {
+        return NULL;
     }
 
-    // path must be a dir from now on
+    if (task) {
+        // another worker may list the directory
+        spawn(task, path, maxDepth);
+        return NULL;
+    }
 
     if (isSet(type, ONLY_DIRECTORY)) {
-        printf("%s\n", path);
+        printPath(output, path);
+    }
+
+    // the entries would be beyond maxdepth
+    if (maxDepth == 0) {
+        return NULL;
+    }
+
+    const int fd = openat(directoryFd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    DIR* directory = fdopendir(fd);
+    if (directory == NULL) {
+        close(fd);
     }
 
-    DIR* directory = opendir(path);
+    return directory;
+}
+
+/**
+ * @brief Crawl the opened directory path and everything below it, then close it.
+ *
+ * @details The tree is walked depth first with an explicit stack instead of recursion, so deep trees need neither
+ * stack nor a path buffer per level. At most MAX_OPEN_DIRECTORIES directories are open at a time: when a deeper one
+ * is opened, the entries left in the oldest one are read into memory and it is closed, to be opened again by path
+ * once its entries are handled.
+ */
+static void crawlDirectory(DIR* directory, const char* path, const int maxDepth, const char type, struct task* task,
+                           const off_t size, regex_t* line_regex) {
+    struct walk walk = {0};
+
+    const size_t pathLength = strlen(path);
+    walk.path = grow(NULL, &walk.pathCapacity, pathLength + 1, 1);
+    memcpy(walk.path, path, pathLength + 1);
+
+    pushFrame(&walk, directory, pathLength, maxDepth);
+
+    while (walk.depth > 0) {
+        struct frame* frame = &walk.frames[walk.depth - 1];
+
+        if (frame->directory == NULL && frame->fd < 0 && frame->restPosition < frame->restLength) {
+            walk.path[frame->pathLength] = '\0';
+            frame->fd = openDirectory(walk.path);
+            if (frame->fd < 0) {
+                // the entries cannot be reached anymore
+                frame->restPosition = frame->restLength;
+            }
+        }
+
+        const char* name;
+        unsigned char entryType;
+        if (!nextEntry(frame, &name, &entryType)) {
+            popFrame(&walk);
+            continue;
+        }
+
+        appendName(&walk.path, &walk.pathCapacity, frame->pathLength, name);
+
+        const int directoryFd = frame->directory ? dirfd(frame->directory) : frame->fd;
+        const int entryDepth = frame->maxDepth - 1;
+        DIR* child = crawlEntry(directoryFd, name, entryType, walk.path, entryDepth, type, task, size, line_regex);
+        if (child == NULL) {
+            continue;
+        }
+
+        // a drained directory is opened again when the walk comes back to it
+        if (frame->fd >= 0) {
+            close(frame->fd);
+            frame->fd = -1;
+        }
+
+        pushFrame(&walk, child, frame->pathLength + 1 + strlen(name), entryDepth);
+    }
+
+    free(walk.frames);
+    free(walk.path);
+}
+
+/**
+ * @brief Read the directory path into the index, with type, size and modification time of its files and
+ * subdirectories. Returns the handle of the directory, or -1 if it cannot be read.
+ */
+static long indexDirectory(char* path, const struct stat* directoryStatus) {
+    const int fd = openDirectory(path);
+    if (fd < 0) {
+        return -1;
+    }
+
+    DIR* directory = fdopendir(fd);
+    if (directory == NULL) {
+        close(fd);
+        return -1;
+    }
+
+    const long handle = beginDirectory(path, directoryStatus);
+    const int directoryFd = dirfd(directory);
     struct dirent* current_entry;
 
     while ((current_entry = readdir(directory)) != NULL) {
         // filter out unneeded entries
-        if (stringsEqual(current_entry->d_name, ".") || stringsEqual(current_entry->d_name, "..")) {
+        if (isDotOrDotDot(current_entry->d_name)) {
             continue;
         }
 
-        char newPath[strlen(path) + strlen(current_entry->d_name) + 1];
-        snprintf(newPath, PATH_MAX, "%s/%s", path, current_entry->d_name);
+        // crawl ignores everything else, so it is neither stat'ed nor stored
+        const unsigned char entryType = current_entry->d_type;
+        if (entryType != DT_UNKNOWN && entryType != DT_REG && entryType != DT_DIR) {
+            continue;
+        }
 
-        crawl(newPath, maxDepth - 1, pattern, type, 0, size, line_regex);
+        struct stat status;
+        if (fstatat(directoryFd, current_entry->d_name, &status, AT_SYMLINK_NOFOLLOW) != 0 ||
+            !(S_ISREG(status.st_mode) || S_ISDIR(status.st_mode))) {
+            continue;
+        }
+
+        const struct indexEntry entry = {
+            .name = current_entry->d_name,
+            .type = S_ISREG(status.st_mode) ? INDEX_FILE : INDEX_DIRECTORY,
+            .size = status.st_size,
+            .mtime = status.st_mtim,
+            .device = status.st_dev,
+            .inode = status.st_ino,
+        };
+        addEntry(&entry);
     }
 
     closedir(directory);
+
+    return handle;
+}
+
+/// A directory on the stack of crawlIndexed().
+struct indexFrame {
+    long handle;
+    /// The entry handled next.
+    size_t next;
+    /// Whether the entries have been read just now rather than taken from the index.
+    bool fresh;
+    size_t pathLength;
+    int maxDepth;
+};
+
+/**
+ * @brief Like crawlDirectory(), but for -index: the entries come from the index if the directory has not been
+ * modified since the last run.
+ *
+ * @details Only subdirectories are stat'ed, to find out whether they were modified. Names, types and sizes of files
+ * come from the index, only -line still reads them. A directory is read completely before the walk descends, so no
+ * directory stays open.
+ */
+static void crawlIndexed(const char* path, const struct stat* status, const int maxDepth, const char type,
+                         const off_t size, regex_t* line_regex) {
+    struct indexFrame* frames = NULL;
+    size_t depth = 0;
+    size_t capacity = 0;
+
+    size_t pathCapacity = 0;
+    const size_t pathLength = strlen(path);
+    char* currentPath = grow(NULL, &pathCapacity, pathLength + 1, 1);
+    memcpy(currentPath, path, pathLength + 1);
+
+    struct stat directoryStatus = *status;
+    size_t directoryLength = pathLength;
+    int directoryDepth = maxDepth;
+
+    while (true) {
+        // enter the directory currentPath, unless its entries would be beyond maxdepth
+        if (directoryDepth > 0) {
+            bool fresh = false;
+            long handle = reuseDirectory(currentPath, &directoryStatus);
+            if (handle < 0) {
+                handle = indexDirectory(currentPath, &directoryStatus);
+                fresh = true;
+            }
+            if (handle >= 0) {
+                frames = grow(frames, &capacity, depth + 1, sizeof(struct indexFrame));
+                frames[depth++] = (struct indexFrame){
+                    .handle = handle,
+                    .fresh = fresh,
+                    .pathLength = directoryLength,
+                    .maxDepth = directoryDepth,
+                };
+            }
+        }
+
+        // find the next subdirectory, handling the files on the way
+        bool found = false;
+        while (depth > 0 && !found) {
+            struct indexFrame* frame = &frames[depth - 1];
+            if (frame->next == getEntryCount(frame->handle)) {
+                depth--;
+                continue;
+            }
+
+            struct indexEntry entry;
+            getEntry(frame->handle, frame->next++, &entry);
+
+            appendName(&currentPath, &pathCapacity, frame->pathLength, entry.name);
+
+            if (entry.type == INDEX_FILE) {
+                // -line reads the file anyway and takes its current size, a size from the index could be stale
+                struct stat status = {.st_mode = S_IFREG, .st_size = entry.size};
+
+                if (isSet(type, ONLY_FILE) && (!checkNamePattern || matchNameFilter(entry.name)) &&
+                    checkFile(AT_FDCWD, currentPath, currentPath, checkLineRegex ? NULL : &status, size, line_regex,
+                              results)) {
+                    printPath(results, currentPath);
+                }
+                continue;
+            }
+
+            // entries read just now are up to date, those from the index may have been modified or replaced since
+            struct stat status;
+            if (frame->fresh) {
+                status.st_mtim = entry.mtime;
+                status.st_dev = entry.device;
+                status.st_ino = entry.inode;
+            } else if (statPath(currentPath, &status) != 0 || !S_ISDIR(status.st_mode)) {
+                continue;
+            }
+
+            if (isSet(type, ONLY_DIRECTORY)) {
+                printPath(results, currentPath);
+            }
+
+            directoryStatus = status;
+            directoryLength = frame->pathLength + 1 + strlen(entry.name);
+            directoryDepth = frame->maxDepth - 1;
+            found = true;
+        }
+
+        if (!found) {
+            break;
+        }
+    }
+
+    free(frames);
+    free(currentPath);
+}
+
+/**
+ * @brief Print what matches below path, which is an argument or the directory of a task.
+ *
+ * @details Without a task, crawlDirectory() walks all subdirectories. Within a task, they become tasks of their own
+ * and only the directory of the task itself is listed.
+ */
+static void crawl(char* path, const int maxDepth, const char type, struct task* task, const off_t size,
+                  regex_t* line_regex) {
+    if (maxDepth < 0) {
+        return;
+    }
+
+    struct stat status;
+    if (statPath(path, &status) != 0) {
+        return;
+    }
+
+    FILE* output = task ? task->output : results;
+
+    if (S_ISREG(status.st_mode)) {
+        if (isSet(type, ONLY_FILE) && (!checkNamePattern || matchPathName(path)) &&
+            checkFile(AT_FDCWD, path, path, &status, size, line_regex, output)) {
+            printPath(output, path);
+        }
+        return;
+    }
+
+    if (!S_ISDIR(status.st_mode)) {
+        return;
+    }
+
+    if (isSet(type, ONLY_DIRECTORY)) {
+        printPath(output, path);
+    }
+
+    if (indexFile) {
+        crawlIndexed(path, &status, maxDepth, type, size, line_regex);
+        return;
+    }
+
+    // the entries would be beyond maxdepth
+    if (maxDepth == 0) {
+        return;
+    }
+
+    const int fd = openDirectory(path);
+    if (fd < 0) {
+        return;
+    }
+
+    DIR* directory = fdopendir(fd);
+    if (directory == NULL) {
+        close(fd);
+        return;
+    }
+
+    crawlDirectory(directory, path, maxDepth, type, task, size, line_regex);
+}
+
+static struct task* newTask(const char* path, const int maxDepth) {
+    struct task* task = calloc(1, sizeof(struct task));
+    if (task == NULL || (task->path = strdup(path)) == NULL) {
+        die("malloc");
+    }
+    task->maxDepth = maxDepth;
+
+    return task;
+}
+
+static void freeTask(struct task* task) {
+    free(task->segments);
+    free(task->path);
+    free(task);
+}
+
+static void push(struct worker* worker, struct task* task) {
+    atomic_fetch_add(&pool.pending, 1);
+
+    pthread_mutex_lock(&worker->mutex);
+    if (worker->end == worker->capacity) {
+        // move the remaining tasks to the front before growing
+        memmove(worker->tasks, worker->tasks + worker->first, (worker->end - worker->first) * sizeof(struct task*));
+        worker->end -= worker->first;
+        worker->first = 0;
+
+        if (worker->end * 2 >= worker->capacity) {
+            worker->capacity = worker->capacity ? worker->capacity * 2 : 64;
+            worker->tasks = realloc(worker->tasks, worker->capacity * sizeof(struct task*));
+            if (worker->tasks == NULL) {
+                die("realloc");
+            }
+        }
+    }
+    worker->tasks[worker->end++] = task;
+    pthread_mutex_unlock(&worker->mutex);
+
+    // a sleeper registers before it looks for tasks, so either it sees this one or it gets woken up
+    if (atomic_load(&pool.sleepers) > 0) {
+        pthread_mutex_lock(&pool.idleMutex);
+        pool.generation++;
+        pthread_cond_signal(&pool.idleCondition);
+        pthread_mutex_unlock(&pool.idleMutex);
+    }
+}
+
+/// The newest task of the worker, so that each worker goes depth first.
+static struct task* pop(struct worker* worker) {
+    struct task* task = NULL;
+
+    pthread_mutex_lock(&worker->mutex);
+    if (worker->end > worker->first) {
+        task = worker->tasks[--worker->end];
+    }
+    pthread_mutex_unlock(&worker->mutex);
+
+    return task;
+}
+
+/// The oldest task of the worker, which is the closest to the root and probably has the most work below it.
+static struct task* steal(struct worker* worker) {
+    struct task* task = NULL;
+
+    pthread_mutex_lock(&worker->mutex);
+    if (worker->end > worker->first) {
+        task = worker->tasks[worker->first++];
+    }
+    pthread_mutex_unlock(&worker->mutex);
+
+    return task;
+}
+
+static struct task* stealAny(const struct worker* self) {
+    const int index = self - pool.workers;
+
+    for (int i = 1; i < pool.count; i++) {
+        struct task* task = steal(&pool.workers[(index + i) % pool.count]);
+        if (task) {
+            return task;
+        }
+    }
+
+    return NULL;
+}
+
+/// The next task for the worker, or NULL once all tasks are finished.
+static struct task* nextTask(struct worker* self) {
+    struct task* task = pop(self);
+
+    while (task == NULL) {
+        pthread_mutex_lock(&pool.idleMutex);
+        atomic_fetch_add(&pool.sleepers, 1);
+        const unsigned long generation = pool.generation;
+        pthread_mutex_unlock(&pool.idleMutex);
+
+        task = stealAny(self);
+
+        pthread_mutex_lock(&pool.idleMutex);
+        while (task == NULL && generation == pool.generation && atomic_load(&pool.pending) > 0) {
+            pthread_cond_wait(&pool.idleCondition, &pool.idleMutex);
+        }
+        atomic_fetch_sub(&pool.sleepers, 1);
+        pthread_mutex_unlock(&pool.idleMutex);
+
+        if (task == NULL && atomic_load(&pool.pending) == 0) {
+            return NULL;
+        }
+    }
+
+    return task;
+}
+
+static void openOutput(struct task* task) {
+    task->output = open_memstream(&task->text, &task->length);
+    if (task->output == NULL) {
+        die("open_memstream");
+    }
+}
+
+/// Finish the current segment of the output, the next one starts after child.
+static void addSegment(struct task* task, struct task* child) {
+    fclose(task->output);
+
+    if (task->segmentCount == task->segmentCapacity) {
+        task->segmentCapacity = task->segmentCapacity ? task->segmentCapacity * 2 : 8;
+        task->segments = realloc(task->segments, task->segmentCapacity * sizeof(struct segment));
+        if (task->segments == NULL) {
+            die("realloc");
+        }
+    }
+    task->segments[task->segmentCount++] = (struct segment){task->text, task->length, child};
+}
+
+static void spawn(struct task* parent, const char* path, const int maxDepth) {
+    struct task* child = newTask(path, maxDepth);
+
+    if (pool.ordered) {
+        // the output of the child goes between what the parent printed so far and what follows
+        addSegment(parent, child);
+        openOutput(parent);
+    }
+
+    push(parent->worker, child);
+}
+
+static void runTask(struct worker* self, struct task* task) {
+    task->worker = self;
+    openOutput(task);
+
+    crawl(task->path, task->maxDepth, pool.type, task, pool.size, pool.lineRegex);
+
+    if (pool.ordered) {
+        addSegment(task, NULL);
+
+        pthread_mutex_lock(&pool.doneMutex);
+        task->done = true;
+        pthread_cond_broadcast(&pool.doneCondition);
+        pthread_mutex_unlock(&pool.doneMutex);
+    } else {
+        // one chunk per directory keeps the lines of a file together
+        fclose(task->output);
+        writeChunk(task->text, task->length);
+        freeTask(task);
+    }
+
+    if (atomic_fetch_sub(&pool.pending, 1) == 1) {
+        // the last task is finished, wake up everybody to exit
+        pthread_mutex_lock(&pool.idleMutex);
+        pool.generation++;
+        pthread_cond_broadcast(&pool.idleCondition);
+        pthread_mutex_unlock(&pool.idleMutex);
+    }
+}
+
+static void* work(void* argument) {
+    struct worker* self = argument;
+
+    struct task* task;
+    while ((task = nextTask(self)) != NULL) {
+        runTask(self, task);
+    }
+
+    return NULL;
+}
+
+/// Print the output of the task and its subdirectories in the sequential order, as soon as it is available.
+static void printOrdered(struct task* task) {
+    pthread_mutex_lock(&pool.doneMutex);
+    while (!task->done) {
+        pthread_cond_wait(&pool.doneCondition, &pool.doneMutex);
+    }
+    pthread_mutex_unlock(&pool.doneMutex);
+
+    for (size_t i = 0; i < task->segmentCount; i++) {
+        writeChunk(task->segments[i].text, task->segments[i].length);
+
+        if (task->segments[i].child) {
+            printOrdered(task->segments[i].child);
+        }
+    }
+
+    freeTask(task);
+}
+
+/**
+ * @brief Crawl all arguments with the given number of worker threads.
+ *
+ * @details Every directory is a task. Workers put the subdirectories they find onto their own deque and steal from
+ * the others once it is empty.
+ */
+static void crawlParallel(const int maxDepth) {
+    pool.workers = calloc(pool.count, sizeof(struct worker));
+    if (pool.workers == NULL) {
+        die("calloc");
+    }
+
+    const int argumentCount = getNumberOfArguments();
+    struct task* roots[argumentCount > 0 ? argumentCount : 1];
+
+    for (int i = 0; i < pool.count; i++) {
+        pthread_mutex_init(&pool.workers[i].mutex, NULL);
+    }
+
+    // hand out the arguments round robin before any worker starts
+    for (int i = 0; i < argumentCount; i++) {
+        roots[i] = newTask(getArgument(i), maxDepth);
+        push(&pool.workers[i % pool.count], roots[i]);
+    }
+
+    for (int i = 0; i < pool.count; i++) {
+        errno = pthread_create(&pool.workers[i].thread, NULL, work, &pool.workers[i]);
+        if (errno != 0) {
+            die("pthread_create");
+        }
+    }
+
+    if (pool.ordered) {
+        for (int i = 0; i < argumentCount; i++) {
+            printOrdered(roots[i]);
+        }
+    }
+
+    for (int i = 0; i < pool.count; i++) {
+        pthread_join(pool.workers[i].thread, NULL);
+        pthread_mutex_destroy(&pool.workers[i].mutex);
+        free(pool.workers[i].tasks);
+    }
+
+    free(pool.workers);
+}
+
+/// Exits if an option is given with a value that is not a number, a missing option is fine.
+static bool hasNumber(const char* option, const int error) {
+    if (error == 0) {
+        return true;
+    }
+
+    if (errno != ENOENT) {
+        fprintf(stderr, "crawl: invalid value for -%s: %s\n", option, getValueForOption(option));
+        exit(EXIT_FAILURE);
+    }
+
+    return false;
 }
 
 static int getMaxDepth(void) {
-    const char* depthString = getValueForOption("maxdepth");
+    long long result;
 
-    if (depthString == NULL) {
+    if (!hasNumber("maxdepth", getIntegerForOption("maxdepth", &result))) {
         return INT_MAX;
     }
 
-    const long int result = strtol(depthString, NULL, 10);
-
-    return result < 0 ? 0 : result;
+    return result < 0 ? 0 : result > INT_MAX ? INT_MAX : result;
 }
 
 static int getType(void) {
@@ -177,26 +1631,59 @@ static int getType(void) {
     }
 }
 
-static char* getName(void) {
-    char* name = getValueForOption("name");
+/// Every -name adds a pattern, a name has to match one of them.
+static void getNames(void) {
+    const char* name = NULL;
 
-    if (name == NULL) {
-        return "*";
+    while ((name = getNextValueForOption("name", name)) != NULL) {
+        addNamePattern(name);
+        checkNamePattern = true;
     }
 
-    checkNamePattern = true;
+    compileNameFilter();
+}
+
+/// Positive for files larger than the size, negative for smaller ones. The size may end in K, M or G.
+static off_t getSize(void) {
+    long long result;
+
+    if (!hasNumber("size", getSizeForOption("size", &result))) {
+        return 0;
+    }
+
+    return result;
+}
+
+static int getThreads(void) {
+    long long result;
 
-    return name;
+    if (!hasNumber("threads", getIntegerForOption("threads", &result))) {
+        return 1;
+    }
+
+    return result < 1 ? 1 : result > INT_MAX ? INT_MAX : result;
 }
 
-static int getSize(void) {
-    const char* sizeString = getValueForOption("size");
+static int getScanners(void) {
+    long long result;
 
-    if (sizeString == NULL) {
+    if (!hasNumber("scanners", getIntegerForOption("scanners", &result))) {
         return 0;
     }
 
-    return strtol(sizeString, NULL, 10);
+    return result < 0 ? 0 : result > INT_MAX ? INT_MAX : result;
+}
+
+static bool getPrint0(void) {
+    const char* print0String = getValueForOption("print0");
+
+    return print0String != NULL && !stringsEqual(print0String, "0");
+}
+
+static bool getOrdered(void) {
+    const char* orderedString = getValueForOption("ordered");
+
+    return orderedString != NULL && !stringsEqual(orderedString, "0");
 }
 
 static char* getLine(void) {
@@ -216,8 +1703,8 @@ int main(const int argc, char* argv[]) {
 
     int type = getType();
     const int maxDepth = getMaxDepth();
-    const char* pattern = getName();
-    const int size = getSize();
+    getNames();
+    const off_t size = getSize();
     const char* line = getLine();
 
     regex_t linePattern;
@@ -227,16 +1714,73 @@ int main(const int argc, char* argv[]) {
         fprintf(stderr, "invalid regex: code %d\n", regexError);
     }
 
+    char literal[strlen(line) + 1];
+    if (checkLineRegex && regexError == 0) {
+        lineLiteralLength = requiredLiteral(line, literal);
+        lineLiteral = lineLiteralLength > 0 ? literal : NULL;
+        catchBusErrors();
+    }
+
     if (size != 0 || checkLineRegex || checkNamePattern) {
         type = ONLY_FILE;
     }
 
-    int i = 0;
-    char* current_directory;
-    while ((current_directory = getArgument(i)) != NULL) {
-        crawl(current_directory, maxDepth, pattern, type, 0, size, &linePattern);
-        i++;
+    const int threads = getThreads();
+    indexFile = getValueForOption("index");
+
+    if (getPrint0()) {
+        pathTerminator = '\0';
+    }
+    openResults();
+
+    if (indexFile && openIndex(indexFile) != 0) {
+        perror(indexFile);
+        indexFile = NULL;
+    }
+
+    // the index is built in the order of a sequential walk, so it takes precedence over -threads
+    const bool parallel = threads > 1 && !indexFile;
+
+    // ordered workers keep the output of each directory in place, so they search the files themselves
+    if (checkLineRegex && !(parallel && getOrdered())) {
+        scanner.count = getScanners();
+        scanner.ordered = getOrdered();
+        scanner.lineRegex = &linePattern;
+    }
+    if (scanner.count > 0) {
+        startScanners();
+    }
+
+    if (parallel) {
+        pool.count = threads;
+        pool.ordered = getOrdered();
+        pool.type = type;
+        pool.size = size;
+        pool.lineRegex = &linePattern;
+
+        crawlParallel(maxDepth);
+    } else {
+        int i = 0;
+        char* current_directory;
+        while ((current_directory = getArgument(i)) != NULL) {
+            crawl(current_directory, maxDepth, type, NULL, size, &linePattern);
+            i++;
+        }
+    }
+
+    if (scanner.count > 0) {
+        stopScanners();
+    }
+
+    closeWriter();
+
+    if (indexFile) {
+        if (saveIndex(indexFile) != 0) {
+            perror(indexFile);
+        }
+        closeIndex();
     }
 
     regfree(&linePattern);
+    freeNameFilter();
 }
@@ -0,0 +1,236 @@
+#include "crawlFilter.h"
+
+#include <fnmatch.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The literal part of a pattern and how it has to occur in a name.
+enum shape { EXACT, SUFFIX, PREFIX, SUBSTRING, GENERAL };
+
+struct literal {
+    const char* text;
+    size_t length;
+    enum shape shape;
+};
+
+/// The patterns in the order they were added, until compileNameFilter() sorts them.
+static const char** patterns = NULL;
+static size_t patternCount;
+static size_t patternCapacity;
+
+/// Open addressing, the size is a power of two and at most half of the slots are used.
+static struct literal* table = NULL;
+static size_t tableSize;
+
+/// The distinct lengths of suffixes, prefixes and substrings in the table, a name is only hashed for those.
+static size_t* suffixLengths = NULL;
+static size_t suffixLengthCount;
+static size_t* prefixLengths = NULL;
+static size_t prefixLengthCount;
+static size_t* substringLengths = NULL;
+static size_t substringLengthCount;
+
+/// Patterns with wildcards in other places, and whether one of the patterns is just "*".
+static const char** general = NULL;
+static size_t generalCount;
+static bool matchAll = false;
+
+static void* allocate(const size_t count, const size_t size) {
+    void* memory = calloc(count ? count : 1, size);
+    if (memory == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    return memory;
+}
+
+void addNamePattern(const char* pattern) {
+    if (patternCount == patternCapacity) {
+        patternCapacity = patternCapacity ? patternCapacity * 2 : 16;
+        patterns = realloc(patterns, patternCapacity * sizeof(const char*));
+        if (patterns == NULL) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    patterns[patternCount++] = pattern;
+}
+
+static bool isWildcard(const char c) {
+    return c == '*' || c == '?' || c == '[' || c == '\\';
+}
+
+/// Sorts the pattern into a shape, the literal is the pattern without its leading and trailing '*'.
+static struct literal classify(const char* pattern) {
+    const size_t length = strlen(pattern);
+    const bool leading = length > 0 && pattern[0] == '*';
+    const bool trailing = length > 1 && pattern[length - 1] == '*';
+
+    const char* text = pattern + leading;
+    const size_t textLength = length - leading - trailing;
+
+    for (size_t i = 0; i < textLength; i++) {
+        if (isWildcard(text[i])) {
+            return (struct literal){pattern, length, GENERAL};
+        }
+    }
+
+    const enum shape shape = leading && trailing ? SUBSTRING : leading ? SUFFIX : trailing ? PREFIX : EXACT;
+    return (struct literal){text, textLength, shape};
+}
+
+// FNV-1a over the shape and the literal
+static uint64_t hash(const enum shape shape, const char* text, const size_t length) {
+    uint64_t value = 14695981039346656037ULL ^ (uint64_t)shape;
+    value *= 1099511628211ULL;
+
+    for (size_t i = 0; i < length; i++) {
+        value ^= (unsigned char)text[i];
+        value *= 1099511628211ULL;
+    }
+
+    return value;
+}
+
+static bool lookup(const enum shape shape, const char* text, const size_t length) {
+    for (size_t slot = hash(shape, text, length) & (tableSize - 1);; slot = (slot + 1) & (tableSize - 1)) {
+        const struct literal* entry = &table[slot];
+
+        if (entry->text == NULL) {
+            return false;
+        }
+        if (entry->shape == shape && entry->length == length && memcmp(entry->text, text, length) == 0) {
+            return true;
+        }
+    }
+}
+
+/// Adds the literal to the table, false if it is already there.
+static bool insert(const struct literal* literal) {
+    size_t slot = hash(literal->shape, literal->text, literal->length) & (tableSize - 1);
+
+    for (; table[slot].text != NULL; slot = (slot + 1) & (tableSize - 1)) {
+        const struct literal* entry = &table[slot];
+        if (entry->shape == literal->shape && entry->length == literal->length &&
+            memcmp(entry->text, literal->text, literal->length) == 0) {
+            return false;
+        }
+    }
+
+    table[slot] = *literal;
+    return true;
+}
+
+static void addLength(size_t* lengths, size_t* count, const size_t length) {
+    for (size_t i = 0; i < *count; i++) {
+        if (lengths[i] == length) {
+            return;
+        }
+    }
+    lengths[(*count)++] = length;
+}
+
+void compileNameFilter(void) {
+    tableSize = 16;
+    while (tableSize < patternCount * 2) {
+        tableSize *= 2;
+    }
+
+    table = allocate(tableSize, sizeof(struct literal));
+    suffixLengths = allocate(patternCount, sizeof(size_t));
+    prefixLengths = allocate(patternCount, sizeof(size_t));
+    substringLengths = allocate(patternCount, sizeof(size_t));
+    general = allocate(patternCount, sizeof(const char*));
+
+    for (size_t i = 0; i < patternCount; i++) {
+        const struct literal literal = classify(patterns[i]);
+
+        if (literal.shape == GENERAL) {
+            general[generalCount++] = patterns[i];
+            continue;
+        }
+
+        // "*" and "**" leave nothing to compare
+        if (literal.shape != EXACT && literal.length == 0) {
+            matchAll = true;
+            continue;
+        }
+
+        if (!insert(&literal)) {
+            continue;
+        }
+
+        if (literal.shape == SUFFIX) {
+            addLength(suffixLengths, &suffixLengthCount, literal.length);
+        } else if (literal.shape == PREFIX) {
+            addLength(prefixLengths, &prefixLengthCount, literal.length);
+        } else if (literal.shape == SUBSTRING) {
+            addLength(substringLengths, &substringLengthCount, literal.length);
+        }
+    }
+}
+
+bool matchNameFilter(const char* name) {
+    if (matchAll) {
+        return true;
+    }
+
+    const size_t length = strlen(name);
+
+    if (lookup(EXACT, name, length)) {
+        return true;
+    }
+
+    for (size_t i = 0; i < suffixLengthCount; i++) {
+        if (suffixLengths[i] <= length && lookup(SUFFIX, name + length - suffixLengths[i], suffixLengths[i])) {
+            return true;
+        }
+    }
+
+    for (size_t i = 0; i < prefixLengthCount; i++) {
+        if (prefixLengths[i] <= length && lookup(PREFIX, name, prefixLengths[i])) {
+            return true;
+        }
+    }
+
+    for (size_t i = 0; i < substringLengthCount; i++) {
+        for (size_t start = 0; start + substringLengths[i] <= length; start++) {
+            if (lookup(SUBSTRING, name + start, substringLengths[i])) {
+                return true;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < generalCount; i++) {
+        if (fnmatch(general[i], name, 0) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void freeNameFilter(void) {
+    free(patterns);
+    free(table);
+    free(suffixLengths);
+    free(prefixLengths);
+    free(substringLengths);
+    free(general);
+
+    patterns = NULL;
+    patternCount = 0;
+    patternCapacity = 0;
+    table = NULL;
+    suffixLengths = NULL;
+    suffixLengthCount = 0;
+    prefixLengths = NULL;
+    prefixLengthCount = 0;
+    substringLengths = NULL;
+    substringLengthCount = 0;
+    general = NULL;
+    generalCount = 0;
+    matchAll = false;
+}
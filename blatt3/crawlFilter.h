@@ -0,0 +1,45 @@
+#ifndef CRAWLFILTER_H
+#define CRAWLFILTER_H
+
+#include <stdbool.h>
+
+/**
+ * @file  crawlFilter.h
+ * @brief The name patterns of crawl, compiled into one matcher.
+ *
+ * A name matches the filter if it matches any of the patterns added with
+ * addNamePattern(), in the sense of fnmatch() without flags.
+ *
+ * compileNameFilter() sorts the patterns by their shape: names without
+ * wildcards, literal suffixes like "*.log", literal prefixes like "core.*"
+ * and literal substrings like "*tmp*" are looked up in a hash table, so that
+ * the cost of matchNameFilter() depends on the number of distinct literal
+ * lengths rather than on the number of patterns. Only the remaining patterns
+ * are passed to fnmatch().
+ *
+ * After compileNameFilter(), matchNameFilter() may be called from several
+ * threads at once.
+ */
+
+/**
+ * @brief Adds a pattern to the filter. The string must stay valid until
+ *        freeNameFilter().
+ */
+void addNamePattern(const char* pattern);
+
+/**
+ * @brief Builds the matcher from the patterns added so far.
+ */
+void compileNameFilter(void);
+
+/**
+ * @brief Tests whether @a name matches one of the patterns.
+ */
+bool matchNameFilter(const char* name);
+
+/**
+ * @brief Releases the filter and its patterns.
+ */
+void freeNameFilter(void);
+
+#endif // CRAWLFILTER_H
@@ -0,0 +1,353 @@
+#include "crawlIndex.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define INDEX_MAGIC "CRAWLIX2"
+
+// The file consists of the header, the directories sorted by path, the entries and the strings, in this order.
+
+struct header {
+    char magic[8];
+    uint64_t directoryCount;
+    uint64_t entryCount;
+    uint64_t stringSize;
+};
+
+struct directory {
+    /// Offset of the path within the strings.
+    uint64_t path;
+    int64_t mtimeSeconds;
+    int64_t mtimeNanoseconds;
+    uint64_t device;
+    uint64_t inode;
+    /// The entries of a directory are stored one after another.
+    uint64_t firstEntry;
+    uint64_t entryCount;
+};
+
+struct entry {
+    uint64_t name;
+    int64_t size;
+    int64_t mtimeSeconds;
+    int64_t mtimeNanoseconds;
+    uint64_t device;
+    uint64_t inode;
+    uint32_t type;
+    uint32_t unused;
+};
+
+struct snapshot {
+    struct directory* directories;
+    size_t directoryCount;
+    size_t directoryCapacity;
+
+    struct entry* entries;
+    size_t entryCount;
+    size_t entryCapacity;
+
+    char* strings;
+    size_t stringSize;
+    size_t stringCapacity;
+};
+
+/// The snapshot of the previous run, pointing into the mapped file.
+static struct snapshot previous;
+static void* mapping = NULL;
+static size_t mappingSize;
+
+/// The snapshot built by this run.
+static struct snapshot current;
+
+static void* grow(void* array, size_t* capacity, const size_t needed, const size_t elementSize) {
+    if (needed <= *capacity) {
+        return array;
+    }
+
+    size_t newCapacity = *capacity ? *capacity * 2 : 1024;
+    while (newCapacity < needed) {
+        newCapacity *= 2;
+    }
+
+    array = realloc(array, newCapacity * elementSize);
+    if (array == NULL) {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+    }
+    *capacity = newCapacity;
+
+    return array;
+}
+
+static uint64_t addString(const char* string) {
+    const size_t length = strlen(string) + 1;
+    const uint64_t offset = current.stringSize;
+
+    current.strings = grow(current.strings, &current.stringCapacity, current.stringSize + length, 1);
+    memcpy(current.strings + offset, string, length);
+    current.stringSize += length;
+
+    return offset;
+}
+
+/// Checks that all offsets of the mapped snapshot lie within the file, and that the directories are sorted.
+static int isValid(const struct header* header, const size_t size) {
+    if (size < sizeof(struct header) || memcmp(header->magic, INDEX_MAGIC, sizeof(header->magic)) != 0) {
+        return 0;
+    }
+
+    size_t rest = size - sizeof(struct header);
+    if (header->directoryCount > rest / sizeof(struct directory)) {
+        return 0;
+    }
+    rest -= header->directoryCount * sizeof(struct directory);
+    if (header->entryCount > rest / sizeof(struct entry)) {
+        return 0;
+    }
+    rest -= header->entryCount * sizeof(struct entry);
+    if (header->stringSize != rest || (rest > 0 && ((const char*)header)[size - 1] != '\0')) {
+        return 0;
+    }
+
+    const struct directory* directories = (const struct directory*)(header + 1);
+    const struct entry* entries = (const struct entry*)(directories + header->directoryCount);
+    const char* strings = (const char*)(entries + header->entryCount);
+
+    for (uint64_t i = 0; i < header->directoryCount; i++) {
+        const struct directory* directory = &directories[i];
+
+        if (directory->path >= rest || directory->firstEntry > header->entryCount ||
+            directory->entryCount > header->entryCount - directory->firstEntry) {
+            return 0;
+        }
+        if (i > 0 && strcmp(strings + directories[i - 1].path, strings + directory->path) >= 0) {
+            return 0;
+        }
+    }
+
+    for (uint64_t i = 0; i < header->entryCount; i++) {
+        if (entries[i].name >= rest) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+int openIndex(const char* file) {
+    const int fd = open(file, O_RDONLY);
+    if (fd < 0) {
+        return errno == ENOENT ? 0 : -1;
+    }
+
+    struct stat status;
+    if (fstat(fd, &status) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    if (status.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    void* data = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return -1;
+    }
+
+    const struct header* header = data;
+    if (!isValid(header, status.st_size)) {
+        fprintf(stderr, "%s: invalid index, crawling everything again\n", file);
+        munmap(data, status.st_size);
+        return 0;
+    }
+
+    mapping = data;
+    mappingSize = status.st_size;
+
+    previous.directories = (struct directory*)(header + 1);
+    previous.directoryCount = header->directoryCount;
+    previous.entries = (struct entry*)(previous.directories + header->directoryCount);
+    previous.entryCount = header->entryCount;
+    previous.strings = (char*)(previous.entries + header->entryCount);
+    previous.stringSize = header->stringSize;
+
+    return 0;
+}
+
+long beginDirectory(const char* path, const struct stat* status) {
+    const uint64_t pathOffset = addString(path);
+
+    current.directories = grow(current.directories, &current.directoryCapacity, current.directoryCount + 1,
+                               sizeof(struct directory));
+    current.directories[current.directoryCount] = (struct directory){
+        .path = pathOffset,
+        .mtimeSeconds = status->st_mtim.tv_sec,
+        .mtimeNanoseconds = status->st_mtim.tv_nsec,
+        .device = status->st_dev,
+        .inode = status->st_ino,
+        .firstEntry = current.entryCount,
+        .entryCount = 0,
+    };
+
+    return current.directoryCount++;
+}
+
+void addEntry(const struct indexEntry* entry) {
+    const uint64_t name = addString(entry->name);
+
+    current.entries = grow(current.entries, &current.entryCapacity, current.entryCount + 1, sizeof(struct entry));
+    current.entries[current.entryCount++] = (struct entry){
+        .name = name,
+        .size = entry->size,
+        .mtimeSeconds = entry->mtime.tv_sec,
+        .mtimeNanoseconds = entry->mtime.tv_nsec,
+        .device = entry->device,
+        .inode = entry->inode,
+        .type = entry->type,
+    };
+
+    current.directories[current.directoryCount - 1].entryCount++;
+}
+
+long reuseDirectory(const char* path, const struct stat* status) {
+    // binary search, the directories of the previous snapshot are sorted by path
+    size_t low = 0;
+    size_t high = previous.directoryCount;
+
+    while (low < high) {
+        const size_t middle = low + (high - low) / 2;
+        const int order = strcmp(previous.strings + previous.directories[middle].path, path);
+
+        if (order == 0) {
+            low = middle;
+            break;
+        }
+        if (order < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    if (low >= high) {
+        return -1;
+    }
+
+    const struct directory* directory = &previous.directories[low];
+    // the same mtime is not enough, the directory might have been replaced by another one
+    if (directory->device != (uint64_t)status->st_dev || directory->inode != (uint64_t)status->st_ino ||
+        directory->mtimeSeconds != status->st_mtim.tv_sec || directory->mtimeNanoseconds != status->st_mtim.tv_nsec) {
+        return -1;
+    }
+
+    const long handle = beginDirectory(path, status);
+
+    for (uint64_t i = 0; i < directory->entryCount; i++) {
+        const struct entry* old = &previous.entries[directory->firstEntry + i];
+        const struct indexEntry entry = {
+            .name = previous.strings + old->name,
+            .type = old->type,
+            .size = old->size,
+            .mtime = {old->mtimeSeconds, old->mtimeNanoseconds},
+            .device = old->device,
+            .inode = old->inode,
+        };
+
+        addEntry(&entry);
+    }
+
+    return handle;
+}
+
+size_t getEntryCount(const long directory) {
+    return current.directories[directory].entryCount;
+}
+
+void getEntry(const long directory, const size_t index, struct indexEntry* entry) {
+    const struct entry* stored = &current.entries[current.directories[directory].firstEntry + index];
+
+    entry->name = current.strings + stored->name;
+    entry->type = stored->type;
+    entry->size = stored->size;
+    entry->mtime.tv_sec = stored->mtimeSeconds;
+    entry->mtime.tv_nsec = stored->mtimeNanoseconds;
+    entry->device = stored->device;
+    entry->inode = stored->inode;
+}
+
+static int comparePaths(const void* a, const void* b) {
+    const struct directory* first = a;
+    const struct directory* second = b;
+
+    return strcmp(current.strings + first->path, current.strings + second->path);
+}
+
+static int writeAll(FILE* stream, const void* data, const size_t size) {
+    return size == 0 || fwrite(data, size, 1, stream) == 1;
+}
+
+int saveIndex(const char* file) {
+    qsort(current.directories, current.directoryCount, sizeof(struct directory), comparePaths);
+
+    // a directory below two arguments is visited twice, keep it once
+    size_t unique = 0;
+    for (size_t i = 0; i < current.directoryCount; i++) {
+        if (unique == 0 || comparePaths(&current.directories[unique - 1], &current.directories[i]) != 0) {
+            current.directories[unique++] = current.directories[i];
+        }
+    }
+    current.directoryCount = unique;
+
+    const struct header header = {
+        .magic = INDEX_MAGIC,
+        .directoryCount = current.directoryCount,
+        .entryCount = current.entryCount,
+        .stringSize = current.stringSize,
+    };
+
+    // write next to the old file and rename, so that an interrupted run leaves the old snapshot intact
+    char temporary[strlen(file) + sizeof(".tmp")];
+    snprintf(temporary, sizeof(temporary), "%s.tmp", file);
+
+    FILE* stream = fopen(temporary, "w");
+    if (stream == NULL) {
+        return -1;
+    }
+
+    const int written = writeAll(stream, &header, sizeof(header)) &&
+                        writeAll(stream, current.directories, current.directoryCount * sizeof(struct directory)) &&
+                        writeAll(stream, current.entries, current.entryCount * sizeof(struct entry)) &&
+                        writeAll(stream, current.strings, current.stringSize);
+
+    if (fclose(stream) != 0 || !written || rename(temporary, file) != 0) {
+        const int error = errno;
+        unlink(temporary);
+        errno = error;
+        return -1;
+    }
+
+    return 0;
+}
+
+void closeIndex(void) {
+    if (mapping) {
+        munmap(mapping, mappingSize);
+        mapping = NULL;
+    }
+    memset(&previous, 0, sizeof(previous));
+
+    free(current.directories);
+    free(current.entries);
+    free(current.strings);
+    memset(&current, 0, sizeof(current));
+}
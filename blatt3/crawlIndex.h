@@ -0,0 +1,113 @@
+#ifndef CRAWLINDEX_H
+#define CRAWLINDEX_H
+
+#include <stddef.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+
+#define INDEX_FILE 1
+#define INDEX_DIRECTORY 2
+
+/**
+ * @file  crawlIndex.h
+ * @brief Snapshot of a directory tree, kept in a file between runs of crawl.
+ *
+ * For every directory crawl has listed, the index stores its path, its
+ * device, inode and modification time and its regular files and
+ * subdirectories with their sizes, modification times, devices and inodes.
+ *
+ * A run opens the snapshot of the previous run with openIndex() and builds
+ * a new one while it walks the tree: directories that are still the same
+ * directory, i.e. have the same device and inode, and whose modification
+ * time is unchanged are copied over with reuseDirectory(), all others are
+ * read again and added with beginDirectory() and addEntry(). saveIndex()
+ * then replaces the old snapshot with the new one, which holds exactly the
+ * directories visited by this run.
+ *
+ * Comparing device and inode catches a directory that is replaced by
+ * another one with the same modification time, e.g. one restored from an
+ * archive or another file system mounted in its place.
+ *
+ * The modification time of a directory only changes if entries are added,
+ * removed or renamed. Files changed in place keep the size recorded in the
+ * index until their directory changes.
+ *
+ * The file is mapped as it is and uses the byte order of the machine that
+ * wrote it.
+ */
+
+/**
+ * @brief An entry of a directory in the index.
+ */
+struct indexEntry {
+    const char* name;
+    /// INDEX_FILE or INDEX_DIRECTORY
+    int type;
+    off_t size;
+    struct timespec mtime;
+    dev_t device;
+    ino_t inode;
+};
+
+/**
+ * @brief Maps the snapshot stored in @a file.
+ *
+ * A missing or invalid file is treated as an empty snapshot.
+ *
+ * @return 0 on success, -1 if the file exists but cannot be read, with @a
+ *         errno set accordingly.
+ */
+int openIndex(const char* file);
+
+/**
+ * @brief Copies the entries of directory @a path from the old snapshot.
+ *
+ * @param status Current device, inode and modification time of the
+ *        directory, other fields are ignored.
+ * @return Handle of the directory in the new snapshot, or -1 if the old
+ *         snapshot does not contain the directory with this device, inode
+ *         and modification time.
+ */
+long reuseDirectory(const char* path, const struct stat* status);
+
+/**
+ * @brief Adds directory @a path to the new snapshot.
+ *
+ * Its entries are added by the calls to addEntry() that follow.
+ *
+ * @return Handle of the directory in the new snapshot.
+ */
+long beginDirectory(const char* path, const struct stat* status);
+
+/**
+ * @brief Adds an entry to the directory begun last.
+ */
+void addEntry(const struct indexEntry* entry);
+
+/**
+ * @brief Retrieves the number of entries of a directory in the new snapshot.
+ */
+size_t getEntryCount(long directory);
+
+/**
+ * @brief Retrieves an entry of a directory in the new snapshot.
+ *
+ * The name stays valid until the next call to reuseDirectory(),
+ * beginDirectory() or addEntry().
+ */
+void getEntry(long directory, size_t index, struct indexEntry* entry);
+
+/**
+ * @brief Writes the new snapshot to @a file, replacing the old one.
+ *
+ * @return 0 on success, -1 on failure with @a errno set accordingly.
+ */
+int saveIndex(const char* file);
+
+/**
+ * @brief Releases both snapshots.
+ */
+void closeIndex(void);
+
+#endif // CRAWLINDEX_H
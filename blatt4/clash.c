@@ -1,5 +1,9 @@
 #include <errno.h>
+#include <fcntl.h>
 #include <linux/limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -8,44 +12,197 @@
 #include <unistd.h>
 
 #include "plist.h"
+#include "teeStage.h"
 
 #define MAX_ARGS 48
+#define MAX_STAGES 16
+/// Exit statuses are below 256, also 128 plus a signal number.
+#define MAX_STATUS 256
 
-struct finished_process {
-    pid_t pid;
-    int status;
-    const char* command;
-};
+extern char** environ;
 
 char* commandDelimiters = " \t\n";
+char* operatorCharacters = "|<>&";
+
+enum tokenType { WORD, PIPE, INPUT, OUTPUT, APPEND, BACKGROUND };
+
+struct token {
+    enum tokenType type;
+    /// Only set for a WORD.
+    char* word;
+};
+
+/// A command of a pipeline with its redirections.
+struct stage {
+    char* argv[MAX_ARGS];
+    int argc;
+    char* input;
+    char* output;
+    bool append;
+};
+
+struct pipeline {
+    struct stage stages[MAX_STAGES];
+    int count;
+    bool background;
+};
 
 list backgroundProcesses;
-struct finished_process* finishedProcess;
 
-int walk_getFinishedProcess(pid_t pid, const char* cmd) {
-    int status = 0;
-    if (waitpid(pid, &status, WNOHANG) != 0) {
-        finishedProcess = malloc(sizeof(struct finished_process));
-        finishedProcess->pid = pid;
-        finishedProcess->status = status;
-        finishedProcess->command = cmd;
-        return -1;
-    }
+/// The SIGCHLD handler writes to this pipe, so that waiting for input also wakes up when a child exits.
+int childEvents[2];
 
-    return 0;
+/// Input read from stdin that has not been handed out as a line yet.
+char* input = NULL;
+size_t inputLength = 0;
+size_t inputCapacity = 0;
+bool inputEnd = false;
+
+bool stringsEqual(const char* s1, const char* s2) {
+    return strcmp(s1, s2) == 0;
 }
 
-int walk_printBackgroundProcesses(pid_t pid, const char* cmd) {
-    printf("[%d] %s\n", pid, cmd);
-    return 0;
+void printPrompt(void) {
+    char cwd[PATH_MAX];
+    getcwd(cwd, PATH_MAX);
+    fprintf(stderr, "%s: ", cwd);
 }
 
-bool stringsEqual(const char* s1, const char* s2) {
-    return strcmp(s1, s2) == 0;
+/// The exit status of a terminated child, or 128 plus the signal that killed it, like sh reports it.
+int exitStatus(const int status) {
+    return WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
 }
 
 void printExit(char* command, const int status) {
-    fprintf(stderr, "Exitstatus [%s] = %d", command, status);
+    fprintf(stderr, "Exitstatus [%s] = %d\n", command, status);
+}
+
+void handleChild(int signal) {
+    (void)signal;
+
+    // the pipe is non-blocking, if it is full the main loop wakes up anyway
+    const int savedErrno = errno;
+    const ssize_t ignored = write(childEvents[1], "", 1);
+    (void)ignored;
+    errno = savedErrno;
+}
+
+void setupChildEvents(void) {
+    if (pipe(childEvents) == -1) {
+        perror("pipe");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < 2; i++) {
+        fcntl(childEvents[i], F_SETFL, fcntl(childEvents[i], F_GETFL) | O_NONBLOCK);
+        fcntl(childEvents[i], F_SETFD, FD_CLOEXEC);
+    }
+
+    struct sigaction action = {.sa_handler = handleChild, .sa_flags = SA_RESTART | SA_NOCLDSTOP};
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGCHLD, &action, NULL) == -1) {
+        perror("sigaction");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/// Empties the pipe of the SIGCHLD handler, true if a child has exited since the last call.
+bool takeChildEvents(void) {
+    char buffer[64];
+    bool exited = false;
+
+    while (read(childEvents[0], buffer, sizeof(buffer)) > 0) {
+        exited = true;
+    }
+
+    return exited;
+}
+
+/// Reaps all exited children and reports those that ran in the background. True if one was reported.
+bool reapChildren(void) {
+    const long lineMax = sysconf(_SC_LINE_MAX);
+    bool reported = false;
+    int status;
+    pid_t pid;
+
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        char command[lineMax];
+        if (removeElement(&backgroundProcesses, pid, command, lineMax) >= 0) {
+            fprintf(stderr, "BackExitstatus [%s] = %d\n", command, exitStatus(status));
+            reported = true;
+        }
+    }
+
+    return reported;
+}
+
+/**
+ * Returns the next line of stdin including its '\n' in a malloc'ed buffer, or NULL at the end of the input.
+ * Background processes that exit while clash waits for input are reported right away, followed by a new prompt.
+ */
+char* readLine(void) {
+    while (true) {
+        char* newline = memchr(input, '\n', inputLength);
+
+        if (newline != NULL || (inputEnd && inputLength > 0)) {
+            const size_t length = newline != NULL ? (size_t)(newline - input) + 1 : inputLength;
+
+            char* line = malloc(length + 1);
+            if (line == NULL) {
+                perror("malloc");
+                exit(EXIT_FAILURE);
+            }
+            memcpy(line, input, length);
+            line[length] = '\0';
+
+            memmove(input, input + length, inputLength - length);
+            inputLength -= length;
+
+            return line;
+        }
+
+        if (inputEnd) {
+            return NULL;
+        }
+
+        struct pollfd events[] = {{.fd = STDIN_FILENO, .events = POLLIN}, {.fd = childEvents[0], .events = POLLIN}};
+        if (poll(events, 2, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            exit(EXIT_FAILURE);
+        }
+
+        if (events[1].revents != 0 && takeChildEvents() && reapChildren()) {
+            printPrompt();
+        }
+
+        if (events[0].revents == 0) {
+            continue;
+        }
+
+        if (inputLength == inputCapacity) {
+            inputCapacity = inputCapacity ? inputCapacity * 2 : 4096;
+            input = realloc(input, inputCapacity);
+            if (input == NULL) {
+                perror("realloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        const ssize_t bytes = read(STDIN_FILENO, input + inputLength, inputCapacity - inputLength);
+        if (bytes > 0) {
+            inputLength += bytes;
+        } else if (bytes == 0 || errno != EINTR) {
+            inputEnd = true;
+        }
+    }
+}
+
+int walk_printBackgroundProcesses(pid_t pid, const char* cmd) {
+    printf("[%d] %s\n", pid, cmd);
+    return 0;
 }
 
 bool handleInternal(char* argv[], int argc, int* status) {
@@ -70,50 +227,540 @@ bool handleInternal(char* argv[], int argc, int* status) {
     return false;
 }
 
-bool handleExternal(const char* fullCommand, char* argv[MAX_ARGS], int* argc, int* status) {
-    const int pid = fork();
-    bool isBackground = false;
+/// Makes the descriptor be closed by exec, so that a command only keeps the ends of pipes it was given.
+void closeOnExec(const int fd) {
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
 
-    if (stringsEqual(argv[*argc - 1], "&")) {
-        isBackground = true;
-        insertElement(&backgroundProcesses, pid, fullCommand);
-        argv[*argc - 1] = NULL;
-        *argc = *argc - 1;
+#ifdef CLASH_USE_FORK
+/// Runs the command in a forked child. A failed exec is passed back through a pipe that exec closes.
+int launch(char* argv[], const int in, const int out, pid_t* pid) {
+    int errorPipe[2];
+    if (pipe(errorPipe) == -1) {
+        return errno;
     }
+    closeOnExec(errorPipe[1]);
+
+    *pid = fork();
+    if (*pid == 0) {
+        close(errorPipe[0]);
+        if (in != STDIN_FILENO) {
+            dup2(in, STDIN_FILENO);
+        }
+        if (out != STDOUT_FILENO) {
+            dup2(out, STDOUT_FILENO);
+        }
+        execvp(argv[0], argv);
 
-    if (pid == 0 && execvp(argv[0], argv) == -1) {
         const int errorNumber = errno;
-        perror("exec");
-        *status = errorNumber;
+        const ssize_t ignored = write(errorPipe[1], &errorNumber, sizeof(errorNumber));
+        (void)ignored;
+        _exit(127);
+    }
+
+    const int forkError = errno;
+    close(errorPipe[1]);
+
+    if (*pid < 0) {
+        close(errorPipe[0]);
+        return forkError;
+    }
+
+    int errorNumber = 0;
+    ssize_t bytes;
+    while ((bytes = read(errorPipe[0], &errorNumber, sizeof(errorNumber))) == -1 && errno == EINTR) {
+    }
+    close(errorPipe[0]);
+
+    if (bytes == sizeof(errorNumber)) {
+        // the child is gone already, do not leave it for the background reaping
+        waitpid(*pid, NULL, 0);
+        return errorNumber;
+    }
+
+    return 0;
+}
+#else
+/**
+ * Runs the command without copying the address space of clash, so launching stays cheap however large the shell
+ * grows. posix_spawnp reports a failed exec as its return value.
+ */
+int launch(char* argv[], const int in, const int out, pid_t* pid) {
+    posix_spawn_file_actions_t actions;
+    int error = posix_spawn_file_actions_init(&actions);
+    if (error != 0) {
+        return error;
+    }
+
+    if (in != STDIN_FILENO) {
+        error = posix_spawn_file_actions_adddup2(&actions, in, STDIN_FILENO);
+    }
+    if (error == 0 && out != STDOUT_FILENO) {
+        error = posix_spawn_file_actions_adddup2(&actions, out, STDOUT_FILENO);
+    }
+    if (error == 0) {
+        error = posix_spawnp(pid, argv[0], &actions, NULL, argv, environ);
+    }
+
+    posix_spawn_file_actions_destroy(&actions);
+    return error;
+}
+#endif
+
+/// "tee FILE" and "tee -a FILE" are run by a child of clash itself, which splices the data instead of copying it.
+bool isTeeStage(const struct stage* stage) {
+    if (!stringsEqual(stage->argv[0], "tee")) {
         return false;
     }
 
-    if (pid < 0) {
+    return (stage->argc == 2 && stage->argv[1][0] != '-') || (stage->argc == 3 && stringsEqual(stage->argv[1], "-a"));
+}
+
+/// Starts the tee stage in a child that does not exec. unused is the end of a pipe only clash may hold.
+int launchTee(const struct stage* stage, const int in, const int out, const int unused, pid_t* pid) {
+    const bool append = stage->argc == 3;
+    const char* path = stage->argv[stage->argc - 1];
+
+    // no O_APPEND, splice() refuses to write to such a file
+    const int file = open(path, O_WRONLY | O_CREAT | (append ? 0 : O_TRUNC), 0666);
+    if (file == -1 || (append && lseek(file, 0, SEEK_END) == -1)) {
+        const int error = errno;
+        perror(path);
+        if (file != -1) {
+            close(file);
+        }
+        return error;
+    }
+
+    *pid = fork();
+    if (*pid == 0) {
+        if (unused != -1) {
+            close(unused);
+        }
+        _exit(teeStage(in, out, file) == 0 ? 0 : 1);
+    }
+
+    const int error = errno;
+    close(file);
+    if (*pid < 0) {
         perror("fork");
+        return error;
+    }
+
+    return 0;
+}
+
+/// Opens the file of a redirection, -1 after printing an error.
+int openRedirection(const char* path, const int flags) {
+    const int fd = open(path, flags | O_CLOEXEC, 0666);
+    if (fd == -1) {
+        perror(path);
     }
 
-    if (isBackground) {
+    return fd;
+}
+
+/**
+ * Starts all stages of the pipeline at once, each connected to the next by a pipe. A stage whose redirection cannot
+ * be opened or whose command cannot be run is left out, like sh does, the others run anyway.
+ *
+ * Returns the pid of the last stage, or -1 if it did not start and status holds its exit status.
+ */
+pid_t startPipeline(struct pipeline* pipeline, pid_t pids[MAX_STAGES], int* status) {
+    int in = STDIN_FILENO;
+
+    for (int i = 0; i < pipeline->count; i++) {
+        struct stage* stage = &pipeline->stages[i];
+        const bool last = i == pipeline->count - 1;
+
+        int connection[2] = {-1, -1};
+        if (!last) {
+            if (pipe(connection) == -1) {
+                perror("pipe");
+                connection[0] = connection[1] = -1;
+            } else {
+                closeOnExec(connection[0]);
+                closeOnExec(connection[1]);
+            }
+        }
+
+        int out = last ? STDOUT_FILENO : connection[1];
+        pids[i] = -1;
+        *status = 1;
+
+        // a redirection takes the place of the pipe, the neighbouring stage sees an empty one
+        if (stage->input != NULL) {
+            if (in != STDIN_FILENO) {
+                close(in);
+            }
+            in = openRedirection(stage->input, O_RDONLY);
+        }
+        if (stage->output != NULL) {
+            if (out != STDOUT_FILENO) {
+                close(out);
+            }
+            out = openRedirection(stage->output, O_WRONLY | O_CREAT | (stage->append ? O_APPEND : O_TRUNC));
+        }
+
+        if (in != -1 && out != -1) {
+            const bool tee = isTeeStage(stage);
+            const int error =
+                tee ? launchTee(stage, in, out, connection[0], &pids[i]) : launch(stage->argv, in, out, &pids[i]);
+
+            if (error != 0) {
+                pids[i] = -1;
+                if (!tee) {
+                    fprintf(stderr, "%s: %s\n", stage->argv[0], strerror(error));
+                    // like sh: 127 if the command was not found, 126 if it could not be run
+                    *status = error == ENOENT ? 127 : 126;
+                }
+            }
+        }
+
+        if (in != STDIN_FILENO && in != -1) {
+            close(in);
+        }
+        if (out != STDOUT_FILENO && out != -1) {
+            close(out);
+        }
+        in = connection[0];
+    }
+
+    return pids[pipeline->count - 1];
+}
+
+/**
+ * Runs the pipeline in the foreground or, if it ends with '&', in the background.
+ *
+ * Returns true if the pipeline runs in the background. Otherwise status is set to the exit status of the last stage.
+ */
+bool runPipeline(const char* fullCommand, struct pipeline* pipeline, int* status) {
+    pid_t pids[MAX_STAGES];
+    const pid_t lastPid = startPipeline(pipeline, pids, status);
+
+    // the other stages are collected without a report when they exit
+    if (pipeline->background) {
+        if (lastPid != -1) {
+            insertElement(&backgroundProcesses, lastPid, fullCommand);
+        }
         return true;
     }
 
-    waitpid(pid, status, 0);
+    for (int i = 0; i < pipeline->count; i++) {
+        int childStatus;
+        if (pids[i] == -1) {
+            continue;
+        }
+        while (waitpid(pids[i], &childStatus, 0) == -1 && errno == EINTR) {
+        }
+        if (pids[i] == lastPid) {
+            *status = exitStatus(childStatus);
+        }
+    }
+
     return false;
 }
 
-int main(void) {
-    char cwd[PATH_MAX];
+/// Splits the line into words and operators, the words are terminated within the line.
+int tokenize(char* line, struct token tokens[]) {
+    int count = 0;
+    char* c = line;
+
+    while (*c != '\0') {
+        if (strchr(commandDelimiters, *c) != NULL) {
+            *c++ = '\0';
+            continue;
+        }
+
+        struct token* token = &tokens[count++];
+        token->word = NULL;
+
+        switch (*c) {
+        case '|':
+            token->type = PIPE;
+            break;
+        case '<':
+            token->type = INPUT;
+            break;
+        case '>':
+            token->type = OUTPUT;
+            if (c[1] == '>') {
+                token->type = APPEND;
+                *c++ = '\0';
+            }
+            break;
+        case '&':
+            token->type = BACKGROUND;
+            break;
+        default:
+            token->type = WORD;
+            token->word = c;
+            while (*c != '\0' && strchr(commandDelimiters, *c) == NULL && strchr(operatorCharacters, *c) == NULL) {
+                c++;
+            }
+            continue;
+        }
+
+        *c++ = '\0';
+    }
+
+    return count;
+}
+
+/**
+ * Fills the pipeline from the line, which is modified. An empty line gives a pipeline without stages.
+ * Returns false after printing a message if the line is no valid command.
+ */
+bool parsePipeline(char* line, struct pipeline* pipeline) {
+    // every token takes at least one character
+    struct token tokens[strlen(line) + 1];
+    const int count = tokenize(line, tokens);
+
+    memset(pipeline, 0, sizeof(*pipeline));
+    if (count == 0) {
+        return true;
+    }
+
+    pipeline->count = 1;
+    struct stage* stage = &pipeline->stages[0];
+
+    for (int i = 0; i < count; i++) {
+        const struct token* token = &tokens[i];
+
+        switch (token->type) {
+        case WORD:
+            if (stage->argc == MAX_ARGS - 1) {
+                fprintf(stderr, "too many arguments\n");
+                return false;
+            }
+            stage->argv[stage->argc++] = token->word;
+            break;
+
+        case PIPE:
+            if (stage->argc == 0) {
+                fprintf(stderr, "syntax error: missing command before '|'\n");
+                return false;
+            }
+            if (pipeline->count == MAX_STAGES) {
+                fprintf(stderr, "too many commands in the pipeline\n");
+                return false;
+            }
+            stage = &pipeline->stages[pipeline->count++];
+            break;
+
+        case INPUT:
+        case OUTPUT:
+        case APPEND:
+            if (i + 1 == count || tokens[i + 1].type != WORD) {
+                fprintf(stderr, "syntax error: missing file name after redirection\n");
+                return false;
+            }
+            if (token->type == INPUT) {
+                stage->input = tokens[++i].word;
+            } else {
+                stage->output = tokens[++i].word;
+                stage->append = token->type == APPEND;
+            }
+            break;
+
+        case BACKGROUND:
+            if (i + 1 != count) {
+                fprintf(stderr, "syntax error: '&' must end the command\n");
+                return false;
+            }
+            pipeline->background = true;
+            break;
+        }
+    }
+
+    if (stage->argc == 0) {
+        fprintf(stderr, "syntax error: missing command\n");
+        return false;
+    }
+
+    return true;
+}
+
+/// Waits for the next child to exit. A job of the script is reported and its exit status counted.
+void collectJob(int* running, int statusCounts[]) {
+    const long lineMax = sysconf(_SC_LINE_MAX);
+    int status;
+    pid_t pid;
+
+    while ((pid = waitpid(-1, &status, 0)) == -1 && errno == EINTR) {
+    }
+
+    if (pid == -1) {
+        // no children left, nothing is running anymore
+        *running = 0;
+        return;
+    }
+
+    char command[lineMax];
+    if (removeElement(&backgroundProcesses, pid, command, lineMax) >= 0) {
+        printExit(command, exitStatus(status));
+        statusCounts[exitStatus(status)]++;
+        (*running)--;
+    }
+}
+
+/// Prints how many commands exited with which status. Returns true if all of them exited with 0.
+bool printSummary(const char* path, const int statusCounts[]) {
+    int commands = 0;
+    for (int i = 0; i < MAX_STATUS; i++) {
+        commands += statusCounts[i];
+    }
+
+    fprintf(stderr, "Summary [%s] = %d commands", path, commands);
+    for (int i = 0; i < MAX_STATUS; i++) {
+        if (statusCounts[i] > 0) {
+            fprintf(stderr, ", %d with status %d", statusCounts[i], i);
+        }
+    }
+    fprintf(stderr, "\n");
+
+    return statusCounts[0] == commands;
+}
+
+/**
+ * Runs the commands of a script without prompting, with up to maxJobs of them at once. Every line is started as soon
+ * as a job has finished, a trailing '&' makes no difference. cd and jobs run in clash itself, in the order of the
+ * script. The exit status of each command is reported when it finishes, a summary of all of them at the end.
+ *
+ * Returns EXIT_SUCCESS if all commands exited with status 0.
+ */
+int runScript(const char* path, const long maxJobs) {
+    FILE* script = fopen(path, "r");
+    if (script == NULL) {
+        perror(path);
+        return EXIT_FAILURE;
+    }
+
+    const long lineMax = sysconf(_SC_LINE_MAX);
+    int statusCounts[MAX_STATUS] = {0};
+    int running = 0;
+
+    char* line = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    int lineNumber = 0;
+
+    while ((length = getline(&line, &capacity, script)) != -1) {
+        lineNumber++;
+
+        if (length > lineMax) {
+            fprintf(stderr, "%s:%d: line longer than %ld characters, skipped\n", path, lineNumber, lineMax);
+            continue;
+        }
+
+        // remove trailing new line
+        if (line[length - 1] == '\n') {
+            line[--length] = '\0';
+        }
+
+        char commandCopy[length + 1];
+        strcpy(commandCopy, line);
+
+        struct pipeline pipeline;
+        int status = 0;
+
+        if (!parsePipeline(commandCopy, &pipeline)) {
+            printExit(line, 2);
+            statusCounts[2]++;
+            continue;
+        }
+        if (pipeline.count == 0) {
+            continue;
+        }
+
+        struct stage* stage = &pipeline.stages[0];
+        const bool simple = pipeline.count == 1 && stage->input == NULL && stage->output == NULL;
+        if (simple && handleInternal(stage->argv, stage->argc, &status)) {
+            continue;
+        }
+
+        while (running >= maxJobs) {
+            collectJob(&running, statusCounts);
+        }
+
+        pid_t pids[MAX_STAGES];
+        const pid_t pid = startPipeline(&pipeline, pids, &status);
+        if (pid == -1) {
+            printExit(line, status);
+            statusCounts[status]++;
+            continue;
+        }
+
+        insertElement(&backgroundProcesses, pid, line);
+        running++;
+    }
+
+    while (running > 0) {
+        collectJob(&running, statusCounts);
+    }
+
+    const bool succeeded = printSummary(path, statusCounts);
+
+    free(line);
+    fclose(script);
+    freeList(&backgroundProcesses);
+
+    return succeeded ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int usage(const char* command) {
+    fprintf(stderr, "usage: %s [-f script [-j jobs]]\n", command);
+    return EXIT_FAILURE;
+}
+
+int main(int argc, char* argv[]) {
+    const char* script = NULL;
+    long maxJobs = 1;
+    bool maxJobsGiven = false;
+    int option;
+
+    while ((option = getopt(argc, argv, "f:j:")) != -1) {
+        switch (option) {
+        case 'f':
+            script = optarg;
+            break;
+        case 'j': {
+            char* end;
+            maxJobs = strtol(optarg, &end, 10);
+            if (end == optarg || *end != '\0' || maxJobs < 1) {
+                fprintf(stderr, "%s: invalid number of jobs: %s\n", argv[0], optarg);
+                return usage(argv[0]);
+            }
+            maxJobsGiven = true;
+            break;
+        }
+        default:
+            return usage(argv[0]);
+        }
+    }
+
+    if (optind != argc || (maxJobsGiven && script == NULL)) {
+        return usage(argv[0]);
+    }
+
+    if (script != NULL) {
+        return runScript(script, maxJobs);
+    }
+
+    setupChildEvents();
+
     while (true) {
-        getcwd(cwd, PATH_MAX);
-        fprintf(stderr, "%s: ", cwd);
+        printPrompt();
 
-        char* fullCommand = NULL;
-        size_t length = 0;
-        if (getline(&fullCommand, &length, stdin) == -1) {
-            free(fullCommand);
+        char* fullCommand = readLine();
+        if (fullCommand == NULL) {
+            free(input);
+            freeList(&backgroundProcesses);
             return 0;
         }
 
         if (strlen(fullCommand) > sysconf(_SC_LINE_MAX)) {
+            free(fullCommand);
             continue;
         }
 
@@ -121,35 +768,32 @@ int main(void) {
 
         if (!onlyShowResults) {
             // remove trailing new line
-            fullCommand[strlen(fullCommand) - 1] = '\0';
-
-            char commandCopy[strlen(fullCommand)];
-            strcpy(commandCopy, fullCommand);
-
-            char* argv[MAX_ARGS];
-
-            // initialize strtok
-            char* token = strtok(commandCopy, commandDelimiters);
-            argv[0] = token;
-
-            int argc = 1;
-            while ((token = strtok(NULL, commandDelimiters)) != NULL && argc < MAX_ARGS - 1) {
-                argv[argc++] = token;
+            const size_t length = strlen(fullCommand);
+            if (fullCommand[length - 1] == '\n') {
+                fullCommand[length - 1] = '\0';
             }
-            argv[argc] = NULL; // exec needs NULL at the end
 
-            if (argv[0] == NULL) {
-                continue;
-            }
+            char commandCopy[strlen(fullCommand) + 1];
+            strcpy(commandCopy, fullCommand);
 
+            struct pipeline pipeline;
             int status = 0;
-
             bool isBackground = false;
 
-            if (handleInternal(argv, argc, &status)) {
-                isBackground = true;
+            if (!parsePipeline(commandCopy, &pipeline)) {
+                status = 2;
+            } else if (pipeline.count == 0) {
+                free(fullCommand);
+                continue;
             } else {
-                isBackground = handleExternal(fullCommand, argv, &argc, &status);
+                struct stage* stage = &pipeline.stages[0];
+                const bool simple = pipeline.count == 1 && stage->input == NULL && stage->output == NULL;
+
+                if (simple && handleInternal(stage->argv, stage->argc, &status)) {
+                    isBackground = true;
+                } else {
+                    isBackground = runPipeline(fullCommand, &pipeline, &status);
+                }
             }
 
             if (!isBackground) {
@@ -157,19 +801,11 @@ int main(void) {
             }
         }
 
-        walkList(&backgroundProcesses, walk_getFinishedProcess);
-        while (finishedProcess != NULL) {
-            printf("BackExitstatus [%s] = %d\n", finishedProcess->command, finishedProcess->status);
-            char buffer[sysconf(_SC_LINE_MAX)];
-            removeElement(&backgroundProcesses, finishedProcess->pid, buffer, sysconf(_SC_LINE_MAX));
-            walkList(&backgroundProcesses, walk_getFinishedProcess);
-            free(finishedProcess);
-            finishedProcess = NULL;
+        // an empty line always collects, in case a SIGCHLD got lost
+        if (takeChildEvents() || onlyShowResults) {
+            reapChildren();
         }
 
         free(fullCommand);
     }
 }
-
-
-/* TODO: helper implementation */
@@ -1,86 +1,176 @@
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
-#include <sys/types.h>
 #include <string.h>
+#include <sys/types.h>
 
 #include "plist.h"
 
-/* Die Funktionen und Definitionen in dieser Datei bitte unveraendert lassen!
- * Falls Sie einen Bug in dieser Implementierung finden, melden Sie diesen bitte
- * an gbs@sra.uni-hannover.de.
- * Die Implementierung von walkList() ist in der plist_walklist.c vorzunehmen.
+/* The elements array keeps the insertion order that walkList() needs. The
+ * slots map a pid to its element by linear probing; a removed pid is taken
+ * out of its probe sequence by shifting the following slots back, so there
+ * are no tombstones. Removed elements stay in the array until they make up
+ * half of it, then elements and strings are compacted and the slots rebuilt.
  */
 
+static size_t hashPid(const pid_t pid, const size_t slotCount) {
+    // Fibonacci hashing spreads consecutive pids over the table
+    return ((uint64_t)(uint32_t)pid * 11400714819323198485ULL) >> 32 & (slotCount - 1);
+}
+
+/** The slot of pid, or the free slot where it would go. */
+static size_t findSlot(const list *list, const pid_t pid) {
+    size_t slot = hashPid(pid, list->slotCount);
+
+    while (list->slots[slot] != 0 && list->elements[list->slots[slot] - 1].pid != pid) {
+        slot = (slot + 1) & (list->slotCount - 1);
+    }
+
+    return slot;
+}
+
+static void rebuildSlots(list *list) {
+    memset(list->slots, 0, list->slotCount * sizeof(size_t));
+    list->usedSlots = 0;
+
+    for (size_t i = 0; i < list->count; i++) {
+        if (list->elements[i].cmdLine != PLIST_REMOVED) {
+            list->slots[findSlot(list, list->elements[i].pid)] = i + 1;
+            list->usedSlots++;
+        }
+    }
+}
+
+/** Drops the removed elements and their command lines. Indexes change, so the slots are rebuilt. */
+static void compact(list *list) {
+    size_t count = 0;
+    size_t stringSize = 0;
+
+    for (size_t i = 0; i < list->count; i++) {
+        list_element element = list->elements[i];
+        if (element.cmdLine == PLIST_REMOVED) {
+            continue;
+        }
+
+        // the strings are in the order of the elements, so moving them to the front never overwrites a live one
+        const size_t length = strlen(list->strings + element.cmdLine) + 1;
+        memmove(list->strings + stringSize, list->strings + element.cmdLine, length);
+        element.cmdLine = stringSize;
+        stringSize += length;
+
+        list->elements[count++] = element;
+    }
+
+    list->count = count;
+    list->removed = 0;
+    list->stringSize = stringSize;
+
+    rebuildSlots(list);
+}
+
+static int grow(void **array, size_t *capacity, const size_t needed, const size_t elementSize) {
+    if (needed <= *capacity) {
+        return 0;
+    }
+
+    size_t newCapacity = *capacity ? *capacity : 16;
+    while (newCapacity < needed) {
+        newCapacity *= 2;
+    }
+
+    void *newArray = realloc(*array, newCapacity * elementSize);
+    if (newArray == NULL) {
+        return -1;
+    }
+
+    *array = newArray;
+    *capacity = newCapacity;
+    return 0;
+}
 
 int insertElement(list *list, pid_t pid, const char *cmdLine) {
-	struct qel *lauf = list->head;
-	struct qel *schlepp = NULL;
-
-	while ( lauf ) {
-		if ( lauf->pid == pid ) {
-			return -1;
-		}
-
-		schlepp = lauf;
-		lauf = lauf->next;
-	}
-
-	lauf = malloc(sizeof(struct qel));
-	if ( NULL == lauf ) { return -2; }
-
-	lauf->cmdLine = strdup(cmdLine);
-	if( NULL == lauf->cmdLine ) {
-		free(lauf);
-		return -2;
-	}
-
-	lauf->pid  = pid;
-	lauf->next = NULL;
-
-	/* Einhaengen des neuen Elements */
-	if ( NULL == schlepp ) {
-		list->head = lauf;
-	} else {
-		schlepp->next = lauf;
-	}
-
-	return pid;
+    if (list->slotCount > 0 && list->slots[findSlot(list, pid)] != 0) {
+        return -1;
+    }
+
+    // keep the table at most half full
+    if ((list->usedSlots + 1) * 2 > list->slotCount) {
+        const size_t slotCount = list->slotCount ? list->slotCount * 2 : 64;
+        size_t *slots = malloc(slotCount * sizeof(size_t));
+        if (NULL == slots) {
+            return -2;
+        }
+
+        free(list->slots);
+        list->slots = slots;
+        list->slotCount = slotCount;
+        rebuildSlots(list);
+    }
+
+    const size_t length = strlen(cmdLine) + 1;
+    if (grow((void **)&list->elements, &list->capacity, list->count + 1, sizeof(list_element)) != 0 ||
+        grow((void **)&list->strings, &list->stringCapacity, list->stringSize + length, 1) != 0) {
+        return -2;
+    }
+
+    memcpy(list->strings + list->stringSize, cmdLine, length);
+    list->elements[list->count] = (list_element){.pid = pid, .cmdLine = list->stringSize};
+    list->stringSize += length;
+
+    list->slots[findSlot(list, pid)] = ++list->count;
+    list->usedSlots++;
+
+    return pid;
 }
 
 int removeElement(list *list, pid_t pid, char *buf, size_t buflen) {
-	if ( list->head == NULL ) {
-		return -1;
-	}
-
-	struct qel* lauf = list->head;
-	struct qel* schlepp = NULL;
-
-	while ( lauf ) {
-		if ( lauf->pid == pid ) {
-			if ( NULL == schlepp ) {
-				list->head = list->head->next;
-			} else {
-				schlepp->next = lauf->next;
-			}
-
-			strncpy(buf, lauf->cmdLine, buflen);
-			if( buflen>0 ) {
-				buf[buflen-1]='\0';
-			}
-			int retVal = strlen(lauf->cmdLine);
-
-			/* Speicher freigeben */
-			free(lauf->cmdLine);
-			lauf->cmdLine = NULL;
-			lauf->next = NULL;
-			lauf->pid = 0;
-			free(lauf);
-			return retVal;
-		}
-
-		schlepp = lauf;
-		lauf = lauf->next;
-	}
-
-	/* PID not found */ 
-	return -1;
+    if (list->usedSlots == 0) {
+        return -1;
+    }
+
+    size_t slot = findSlot(list, pid);
+    if (list->slots[slot] == 0) {
+        return -1;
+    }
+
+    list_element *element = &list->elements[list->slots[slot] - 1];
+    const char *cmdLine = list->strings + element->cmdLine;
+
+    strncpy(buf, cmdLine, buflen);
+    if (buflen > 0) {
+        buf[buflen - 1] = '\0';
+    }
+    const int retVal = strlen(cmdLine);
+
+    element->cmdLine = PLIST_REMOVED;
+    list->removed++;
+
+    // move back every following slot of the probe sequence that may take the free one
+    list->slots[slot] = 0;
+    list->usedSlots--;
+    for (size_t next = (slot + 1) & (list->slotCount - 1); list->slots[next] != 0;
+         next = (next + 1) & (list->slotCount - 1)) {
+        const size_t home = hashPid(list->elements[list->slots[next] - 1].pid, list->slotCount);
+
+        // the element stays if its home lies cyclically in (slot, next]
+        const bool stays = slot <= next ? (slot < home && home <= next) : (slot < home || home <= next);
+        if (!stays) {
+            list->slots[slot] = list->slots[next];
+            list->slots[next] = 0;
+            slot = next;
+        }
+    }
+
+    if (list->removed * 2 >= list->count) {
+        compact(list);
+    }
+
+    return retVal;
+}
+
+void freeList(list *list) {
+    free(list->elements);
+    free(list->slots);
+    free(list->strings);
+    memset(list, 0, sizeof(*list));
 }
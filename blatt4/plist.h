@@ -1,30 +1,54 @@
 #ifndef PLIST_H
 #define PLIST_H
 
+#include <stddef.h>
 #include <sys/types.h>
 
 /** \file plist.h
  *
- *  \brief Linked List for maintaining process id - command line pairs.
+ *  \brief Table for maintaining process id - command line pairs.
+ *
+ *  The pairs are kept in insertion order and found by an open addressing
+ *  hash table over the pids, so that inserting and removing a pair does not
+ *  depend on the number of pairs. The command lines are stored one after
+ *  another in a single buffer instead of one allocation per pair. Removed
+ *  pairs leave gaps that are closed once they make up half of the table.
+ *
+ *  A zero-initialized list is empty and ready to use.
  *
  *  This implementation is not thread safe.
  */
-typedef struct qel {
-	pid_t pid;
-	char *cmdLine;
-	struct qel *next;
+#define PLIST_REMOVED ((size_t)-1)
+
+typedef struct {
+    pid_t pid;
+    /** Offset of the '\\0'-terminated command line in the string buffer, PLIST_REMOVED once removed. */
+    size_t cmdLine;
 } list_element;
 
 
 typedef struct {
-  list_element *head;
+    /** The pairs in insertion order, including removed ones until the next compaction. */
+    list_element *elements;
+    size_t count;
+    size_t capacity;
+    size_t removed;
+
+    /** Indexes into elements plus one, 0 for a free slot. The size is a power of two. */
+    size_t *slots;
+    size_t slotCount;
+    size_t usedSlots;
+
+    char *strings;
+    size_t stringSize;
+    size_t stringCapacity;
 } list;
 
 /**
- *  \brief Inserts a new pid-command line pair into the linked list.
+ *  \brief Inserts a new pid-command line pair into the list.
  *
  * During the insert operation, the passed commandLine is copied to
- * an internally allocated buffer. The caller may free or otherwise
+ * the string buffer of the list. The caller may free or otherwise
  * reuse the memory occupied by commandLine after return from
  * insertElement.
  *
@@ -40,9 +64,9 @@ typedef struct {
 int insertElement(list *list, pid_t pid, const char *commandLine);
 
 /**
- *  \brief Remove a specific pid-command line pair from the linked list.
+ *  \brief Remove a specific pid-command line pair from the list.
  *
- * The linked list is searched for a pair with the given pid. If such a pair is
+ * The list is searched for a pair with the given pid. If such a pair is
  * found, the '\\0'-terminated command line is copied to the buffer provided by
  * the caller. If the length of the command line exceeds the size of the
  * buffer, only the first (buffersize-1) characters of the command line are
@@ -75,5 +99,12 @@ int removeElement(list *list, pid_t pid, char *commandLineBuffer, size_t bufferS
  */
 void walkList(list *list, int (*callback) (pid_t, const char *) );
 
+/**
+ *  \brief Releases all memory of the list and leaves it empty.
+ *
+ *  \param list The list to free.
+ */
+void freeList(list *list);
+
 #endif
 
@@ -2,12 +2,15 @@
 #include "plist.h"
 
 void walkList(list *list, int (*callback) (pid_t, const char *) ) {
-	list_element* currentElement = list->head;
-    while (currentElement != NULL) {
-        if (callback(currentElement->pid, currentElement->cmdLine) != 0) {
+    for (size_t i = 0; i < list->count; i++) {
+        const list_element* currentElement = &list->elements[i];
+
+        if (currentElement->cmdLine == PLIST_REMOVED) {
+            continue;
+        }
+
+        if (callback(currentElement->pid, list->strings + currentElement->cmdLine) != 0) {
             return;
         }
-        
-        currentElement = currentElement->next;
     }
 }
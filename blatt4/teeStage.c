@@ -0,0 +1,134 @@
+// tee(2) and splice(2) are Linux specific
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "teeStage.h"
+
+/** Bytes duplicated at once, the default capacity of a pipe. */
+#define CHUNK_SIZE (64 * 1024)
+
+static bool isPipe(const int fd) {
+    struct stat status;
+    return fstat(fd, &status) == 0 && S_ISFIFO(status.st_mode);
+}
+
+static int writeAll(const int fd, const char *data, size_t size) {
+    while (size > 0) {
+        const ssize_t written = write(fd, data, size);
+        if (written == -1 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return -1;
+        }
+        data += written;
+        size -= written;
+    }
+
+    return 0;
+}
+
+static int copyBuffered(const int in, const int out, const int file) {
+    char buffer[CHUNK_SIZE];
+
+    while (true) {
+        const ssize_t bytes = read(in, buffer, sizeof(buffer));
+        if (bytes == -1 && errno == EINTR) {
+            continue;
+        }
+        if (bytes <= 0) {
+            return bytes;
+        }
+        if (writeAll(out, buffer, bytes) != 0 || writeAll(file, buffer, bytes) != 0) {
+            return -1;
+        }
+    }
+}
+
+/**
+ * Moves exactly size bytes out of the pipe from. Splicing stops for good once to turns out not to support it,
+ * for example a terminal, and the rest goes through a buffer.
+ */
+static int transfer(const int from, const int to, size_t size, bool *canSplice) {
+    while (size > 0 && *canSplice) {
+        const ssize_t moved = splice(from, NULL, to, NULL, size, SPLICE_F_MOVE);
+        if (moved == -1 && errno == EINTR) {
+            continue;
+        }
+        if (moved == -1 && errno == EINVAL) {
+            *canSplice = false;
+            break;
+        }
+        if (moved <= 0) {
+            return -1;
+        }
+        size -= moved;
+    }
+
+    char buffer[CHUNK_SIZE];
+    while (size > 0) {
+        const ssize_t bytes = read(from, buffer, size < sizeof(buffer) ? size : sizeof(buffer));
+        if (bytes == -1 && errno == EINTR) {
+            continue;
+        }
+        if (bytes <= 0 || writeAll(to, buffer, bytes) != 0) {
+            return -1;
+        }
+        size -= bytes;
+    }
+
+    return 0;
+}
+
+int teeStage(const int in, const int out, const int file) {
+    if (!isPipe(in)) {
+        return copyBuffered(in, out, file);
+    }
+
+    // tee() only duplicates into a pipe, an output that is none gets one in between
+    int relay[2] = {-1, -1};
+    const bool outIsPipe = isPipe(out);
+    if (!outIsPipe && pipe(relay) == -1) {
+        return -1;
+    }
+    const int target = outIsPipe ? out : relay[1];
+
+    bool fileSplices = true;
+    bool outSplices = true;
+    int result = 0;
+
+    while (true) {
+        const ssize_t duplicated = tee(in, target, CHUNK_SIZE, 0);
+        if (duplicated == -1 && errno == EINTR) {
+            continue;
+        }
+        if (duplicated == -1 && errno == EINVAL) {
+            // nothing was consumed yet, the rest can still be copied
+            result = copyBuffered(in, out, file);
+            break;
+        }
+        if (duplicated <= 0) {
+            result = duplicated;
+            break;
+        }
+
+        // tee() leaves the data in the input, moving it to the file consumes it
+        if (transfer(in, file, duplicated, &fileSplices) != 0 ||
+            (!outIsPipe && transfer(relay[0], out, duplicated, &outSplices) != 0)) {
+            result = -1;
+            break;
+        }
+    }
+
+    if (!outIsPipe) {
+        close(relay[0]);
+        close(relay[1]);
+    }
+
+    return result;
+}
@@ -0,0 +1,26 @@
+#ifndef TEESTAGE_H
+#define TEESTAGE_H
+
+/** \file teeStage.h
+ *
+ *  \brief The tee stage that clash runs itself within a pipeline.
+ *
+ *  If the input is a pipe, the data is duplicated with tee(2) and moved
+ *  with splice(2), so that it never passes through user space. Otherwise,
+ *  or where the kernel does not support splicing a descriptor, it falls
+ *  back to read(2) and write(2).
+ */
+
+/**
+ *  \brief Copies everything from \a in to both \a out and \a file until
+ *  \a in reaches its end.
+ *
+ *  \param in The input of the stage.
+ *  \param out The output of the stage, usually the pipe to the next stage.
+ *  \param file The file the data is written to in addition.
+ *
+ *  \return 0 on success, -1 on error with errno set accordingly.
+ */
+int teeStage(int in, int out, int file);
+
+#endif // TEESTAGE_H